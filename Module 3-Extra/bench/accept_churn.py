@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Connection churn the server sustains.
+
+Starts the server (with any extra flags given after `--`) and has the given number of helper processes connect, get an
+answer to a /ping and disconnect over and over for a while, each one bound to its own loopback address, and reports how
+many connections per second went through and the p50/p99 of each one (connect until the answer is back). The helpers
+close with a reset, so no TIME_WAIT piles up.
+
+    python3 bench/accept_churn.py --server build/server --helpers 4 --seconds 10 -- --defer-accept=1
+"""
+
+import argparse
+import multiprocessing
+import socket
+import struct
+import subprocess
+import time
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))] if values else float("nan")
+
+
+def helper(port, index, seconds, results):
+    source = f"127.0.{index // 250}.{index % 250 + 2}"
+    latencies = []
+    failed = 0
+
+    deadline = time.time() + seconds
+    while time.time() < deadline:
+        started = time.perf_counter()
+        s = socket.socket()
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+        s.settimeout(2)
+        try:
+            s.bind((source, 0))
+            s.connect(("127.0.0.1", port))
+            s.send(b"/ping")
+            if s.recv(64):
+                latencies.append(time.perf_counter() - started)
+            else:
+                failed += 1
+        except OSError:
+            failed += 1
+        finally:
+            s.close()
+
+    results.put((latencies, failed))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--server", required=True, help="server binary")
+    parser.add_argument("--port", type=int, default=24400)
+    parser.add_argument("--helpers", type=int, default=4, help="processes connecting in parallel")
+    parser.add_argument("--seconds", type=float, default=10)
+    parser.add_argument("server_args", nargs="*", help="extra server flags (after --)")
+    args = parser.parse_args()
+
+    server = subprocess.Popen([args.server, str(args.port), "127.0.0.1", *args.server_args],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    time.sleep(0.5)
+
+    results = multiprocessing.Queue()
+    helpers = [multiprocessing.Process(target=helper, args=(args.port, index, args.seconds, results))
+               for index in range(args.helpers)]
+    for process in helpers:
+        process.start()
+
+    latencies = []
+    failed = 0
+    for _ in helpers:
+        helper_latencies, helper_failed = results.get()
+        latencies += helper_latencies
+        failed += helper_failed
+    for process in helpers:
+        process.join()
+
+    server.terminate()
+    server.wait()
+
+    print(f"{args.helpers} helpers, {args.seconds:.0f}s: {len(latencies) / args.seconds:.0f} connections/s "
+          f"({len(latencies)} served, {failed} failed), p50 {percentile(latencies, 0.5) * 1e6:.0f}us "
+          f"p99 {percentile(latencies, 0.99) * 1e6:.0f}us")
+
+
+if __name__ == "__main__":
+    main()
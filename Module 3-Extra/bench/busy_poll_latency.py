@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Round trip latency of the server, default mode against busy-poll mode.
+
+Starts the server once in each mode (with any extra flags given after `--`), sends a series of /ping commands over
+loopback, one at a time, and reports the p50/p99 of the time until each answer is back. Busy-poll mode takes a whole
+core per thread, give it at least as many as it has threads (acceptor, I/O threads and handlers).
+
+    python3 bench/busy_poll_latency.py --server build/server --pings 20000 --busy-poll 50 -- --io-threads=1
+"""
+
+import argparse
+import socket
+import subprocess
+import time
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))] if values else float("nan")
+
+
+def connect(port):
+    for _ in range(100):
+        try:
+            connection = socket.create_connection(("127.0.0.1", port))
+            connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            connection.settimeout(1)
+            return connection
+        except ConnectionRefusedError:
+            time.sleep(0.05)
+
+    raise RuntimeError("the server didn't come up")
+
+
+def measure(server, port, pings, mode_args, server_args):
+    server_process = subprocess.Popen([server, str(port), "127.0.0.1", *mode_args, *server_args],
+                                      stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        connection = connect(port)
+        time.sleep(0.3)
+
+        latencies = []
+        lost = 0
+        for i in range(pings):
+            started = time.perf_counter()
+            connection.send(b"/ping")
+            try:
+                connection.recv(64)
+            except socket.timeout:
+                lost += 1
+                continue
+
+            # Warm-up round trips don't count
+            if i >= pings // 10:
+                latencies.append(time.perf_counter() - started)
+
+        connection.close()
+        return latencies, lost
+    finally:
+        server_process.terminate()
+        server_process.wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--server", required=True, help="server binary")
+    parser.add_argument("--port", type=int, default=24200)
+    parser.add_argument("--pings", type=int, default=20000)
+    parser.add_argument("--busy-poll", type=int, default=50, help="SO_BUSY_POLL time of the busy-poll mode (us)")
+    parser.add_argument("server_args", nargs="*", help="extra server flags for both modes (after --)")
+    args = parser.parse_args()
+
+    modes = [("default", []), ("busy-poll", [f"--busy-poll={args.busy_poll}"])]
+    for name, mode_args in modes:
+        latencies, lost = measure(args.server, args.port, args.pings, mode_args, args.server_args)
+        args.port += 1
+
+        print(f"{name}: {len(latencies)} pings, p50 {percentile(latencies, 0.5) * 1e6:.0f}us "
+              f"p99 {percentile(latencies, 0.99) * 1e6:.0f}us" + (f", {lost} lost" if lost else ""))
+
+
+if __name__ == "__main__":
+    main()
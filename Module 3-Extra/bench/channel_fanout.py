@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Channel fan-out cost of the server.
+
+Starts the server (with any extra flags given after `--`), joins the given number of members to one channel, has the
+first member send a series of messages and reports how long it took for every member to receive all of them, the
+fan-out latency of each message (sent until the last member has it), how much CPU the server used meanwhile and the
+/ping round trip of a client outside the channel (how long the fan-outs hold the event loops).
+
+    python3 bench/channel_fanout.py --server build/server --members 2000 --messages 30 --interval 0.05 -- \
+        --io-threads=4 --fanout-threshold=256
+"""
+
+import argparse
+import os
+import re
+import select
+import socket
+import subprocess
+import threading
+import time
+
+
+def cpu_ms(pid):
+    fields = open(f"/proc/{pid}/stat").read().rsplit(")", 1)[1].split()
+    ticks = int(fields[11]) + int(fields[12])
+    return ticks * 1000 // os.sysconf("SC_CLK_TCK")
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))] if values else float("nan")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--server", required=True, help="server binary")
+    parser.add_argument("--port", type=int, default=24100)
+    parser.add_argument("--members", type=int, default=300)
+    parser.add_argument("--messages", type=int, default=400)
+    parser.add_argument("--interval", type=float, default=0.002, help="seconds between messages")
+    parser.add_argument("server_args", nargs="*", help="extra server flags (after --)")
+    args = parser.parse_args()
+
+    server = subprocess.Popen([args.server, str(args.port), "127.0.0.1", *args.server_args],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    time.sleep(0.5)
+
+    members = []
+    for i in range(args.members):
+        s = socket.create_connection(("127.0.0.1", args.port))
+        s.send(f"/nick u{i}".encode())
+        members.append(s)
+        time.sleep(0.002)
+    time.sleep(0.3)
+
+    for s in members:
+        s.send(b"/join #bench")
+        time.sleep(0.001)
+    time.sleep(1.5)
+
+    pinger = socket.create_connection(("127.0.0.1", args.port))
+    pinger.settimeout(1)
+    time.sleep(0.1)
+
+    # Every message ends with a marker, frames may be merged on the way
+    received = [0] * args.members
+    copies = [0] * args.messages
+    sent_at = [0.0] * args.messages
+    latencies = []
+    stop = False
+
+    def reader():
+        poller = select.epoll()
+        index = {s.fileno(): i for i, s in enumerate(members)}
+        for s in members:
+            s.setblocking(False)
+            poller.register(s, select.EPOLLIN)
+
+        while not stop:
+            for fd, _ in poller.poll(0.1):
+                try:
+                    while True:
+                        data = members[index[fd]].recv(65536)
+                        if not data:
+                            break
+                        received[index[fd]] += data.count(b"|")
+                        now = time.time()
+                        for k in re.findall(rb"m(\d+)\|", data):
+                            k = int(k)
+                            copies[k] += 1
+                            if copies[k] == args.members:
+                                latencies.append(now - sent_at[k])
+                except BlockingIOError:
+                    pass
+
+    pings = []
+
+    def ping():
+        while not stop:
+            started = time.time()
+            pinger.send(b"/ping")
+            try:
+                pinger.recv(64)
+            except socket.timeout:
+                continue
+            pings.append(time.time() - started)
+            time.sleep(0.01)
+
+    thread = threading.Thread(target=reader)
+    thread.start()
+    time.sleep(0.3)
+    pinging = threading.Thread(target=ping)
+    pinging.start()
+
+    expected = args.members * args.messages
+    cpu_start = cpu_ms(server.pid)
+    started = time.time()
+    for k in range(args.messages):
+        sent_at[k] = time.time()
+        members[0].send(f"m{k}|".encode())
+        time.sleep(args.interval)
+
+    while sum(received) < expected and time.time() - started < 60:
+        time.sleep(0.05)
+
+    elapsed = time.time() - started
+    cpu = cpu_ms(server.pid) - cpu_start
+    stop = True
+    thread.join()
+    pinging.join()
+    server.terminate()
+    server.wait()
+
+    print(f"{args.members} members, {args.messages} messages: delivered {sum(received)}/{expected} in {elapsed:.2f}s, "
+          f"server CPU {cpu}ms")
+    print(f"fan-out latency p50 {percentile(latencies, 0.5) * 1000:.1f}ms "
+          f"p99 {percentile(latencies, 0.99) * 1000:.1f}ms, ping p50 {percentile(pings, 0.5) * 1000:.2f}ms "
+          f"p99 {percentile(pings, 0.99) * 1000:.2f}ms")
+
+
+if __name__ == "__main__":
+    main()
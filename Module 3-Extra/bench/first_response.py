@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Time to first response of a new connection, with and without TCP Fast Open.
+
+Starts the server with a plain listener and then with `--fast-open=on` (with any extra flags given after `--`, e.g.
+`--defer-accept=1`), reconnects the given number of times sending a /ping as the first message (in the SYN itself with
+Fast Open) and reports the p50/p99 of the time from the start of the connect until the answer is back. Needs
+`net.ipv4.tcp_fastopen` set to 3 for the Fast Open run, and over loopback the round trip it saves is a few
+microseconds, add a delay (`tc qdisc add dev lo root netem delay 5ms`) to see it.
+
+    python3 bench/first_response.py --server build/server --connections 2000
+"""
+
+import argparse
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))] if values else float("nan")
+
+
+def first_response(port, fast_open):
+    started = time.perf_counter()
+    s = socket.socket()
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+    s.settimeout(2)
+    try:
+        if fast_open:
+            s.sendto(b"/ping", socket.MSG_FASTOPEN, ("127.0.0.1", port))
+        else:
+            s.connect(("127.0.0.1", port))
+            s.send(b"/ping")
+
+        if not s.recv(64):
+            return None
+        return time.perf_counter() - started
+    except OSError:
+        return None
+    finally:
+        s.close()
+
+
+def measure(server, port, connections, fast_open, server_args):
+    mode_args = ["--fast-open=on"] if fast_open else []
+    server_process = subprocess.Popen([server, str(port), "127.0.0.1", *mode_args, *server_args],
+                                      stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    time.sleep(0.5)
+
+    try:
+        # The first connection only gets the Fast Open cookie
+        first_response(port, fast_open)
+
+        latencies = []
+        failed = 0
+        for _ in range(connections):
+            latency = first_response(port, fast_open)
+            if latency is None:
+                failed += 1
+            else:
+                latencies.append(latency)
+
+        return latencies, failed
+    finally:
+        server_process.terminate()
+        server_process.wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--server", required=True, help="server binary")
+    parser.add_argument("--port", type=int, default=24500)
+    parser.add_argument("--connections", type=int, default=2000)
+    parser.add_argument("server_args", nargs="*", help="extra server flags for both runs (after --)")
+    args = parser.parse_args()
+
+    with open("/proc/sys/net/ipv4/tcp_fastopen") as setting:
+        if int(setting.read()) & 3 != 3:
+            print("warning: net.ipv4.tcp_fastopen isn't 3, the Fast Open run falls back to plain connects",
+                  file=sys.stderr)
+
+    for name, fast_open in [("plain", False), ("fast open", True)]:
+        latencies, failed = measure(args.server, args.port, args.connections, fast_open, args.server_args)
+        args.port += 1
+
+        print(f"{name}: {len(latencies)} connections, first response p50 {percentile(latencies, 0.5) * 1e6:.0f}us "
+              f"p99 {percentile(latencies, 0.99) * 1e6:.0f}us" + (f", {failed} failed" if failed else ""))
+
+
+if __name__ == "__main__":
+    main()
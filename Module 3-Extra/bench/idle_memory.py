@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Memory per idle connection of the server.
+
+Starts the server, opens the given numbers of idle connections to it (from helper processes, each one bound to its
+own loopback address so the ephemeral ports don't run out) and reports how much its resident memory grew per
+connection. Needs a file descriptor limit above the largest count (the server raises its soft limit to the hard one).
+
+    python3 bench/idle_memory.py --server build/server --counts 10000,50000,100000
+"""
+
+import argparse
+import multiprocessing
+import os
+import resource
+import socket
+import subprocess
+import sys
+import time
+
+# Connections opened by each helper process
+CONNECTIONS_PER_HELPER = 10000
+
+# Connections opened between pauses
+ACCEPT_PACING = 32
+
+
+def raise_fd_limit():
+    _, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+    return hard
+
+
+def rss_kib(pid):
+    with open(f"/proc/{pid}/status") as status:
+        for line in status:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+
+def open_fds(pid):
+    return len(os.listdir(f"/proc/{pid}/fd"))
+
+
+def helper(port, index, count, ready, done):
+    raise_fd_limit()
+    source = f"127.0.{index // 250}.{index % 250 + 2}"
+    sockets = []
+    try:
+        for _ in range(count):
+            s = socket.socket()
+            s.bind((source, 0))
+            s.settimeout(5)
+            s.connect(("127.0.0.1", port))
+            sockets.append(s)
+
+            # Let the acceptor catch up, the listen backlog is short (overflows cost a SYN retry, a second or more)
+            if len(sockets) % ACCEPT_PACING == 0:
+                time.sleep(0.005)
+    except OSError as e:
+        print(f"helper {index}: stopped at {len(sockets)} connections ({e})", file=sys.stderr)
+    ready.put(len(sockets))
+    done.wait()
+
+
+def measure(server, port, count, settle):
+    server_process = subprocess.Popen(
+        [server, str(port), "127.0.0.1", "--idle-timeout=0", "--ping-interval=0", "--ping-timeout=0"],
+        stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, preexec_fn=raise_fd_limit)
+    time.sleep(0.5)
+
+    base_rss = rss_kib(server_process.pid)
+    base_fds = open_fds(server_process.pid)
+
+    ready = multiprocessing.Queue()
+    done = multiprocessing.Event()
+    # One helper at a time, concurrent connection storms overflow the listen backlog and stall on SYN retries
+    helpers = []
+    connected = 0
+    for index, start in enumerate(range(0, count, CONNECTIONS_PER_HELPER)):
+        chunk = min(CONNECTIONS_PER_HELPER, count - start)
+        process = multiprocessing.Process(target=helper, args=(port, index, chunk, ready, done))
+        process.start()
+        helpers.append(process)
+        connected += ready.get()
+
+    # Wait for the server to take every connection in (or to stop making progress)
+    accepted = 0
+    deadline = time.time() + settle
+    while time.time() < deadline and server_process.poll() is None:
+        accepted = open_fds(server_process.pid) - base_fds
+        if accepted >= connected:
+            break
+        time.sleep(0.2)
+    time.sleep(1)
+
+    if server_process.poll() is not None:
+        print(f"{count} clients: the server exited ({server_process.returncode})")
+        done.set()
+        return
+
+    rss = rss_kib(server_process.pid)
+    done.set()
+    for process in helpers:
+        process.join()
+    server_process.terminate()
+    server_process.wait()
+
+    per_connection = (rss - base_rss) * 1024 / max(accepted, 1)
+    print(f"{count} clients: {connected} connected, {accepted} accepted, RSS {base_rss} -> {rss} KiB, "
+          f"{per_connection:.0f} bytes per connection")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--server", required=True, help="server binary")
+    parser.add_argument("--port", type=int, default=24000)
+    parser.add_argument("--counts", default="10000,50000,100000", help="comma separated connection counts")
+    parser.add_argument("--settle", type=float, default=60, help="seconds to wait for the server to accept them")
+    args = parser.parse_args()
+
+    limit = raise_fd_limit()
+    for count in [int(c) for c in args.counts.split(",")]:
+        if count + 64 > limit:
+            print(f"{count} clients: warning, the file descriptor limit is {limit}", file=sys.stderr)
+        measure(args.server, args.port, count, args.settle)
+        args.port += 1
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Throughput of the shared memory ring against the plain Unix socket.
+
+Starts the server on a Unix socket with `--shm=on` (with any extra flags given after `--`) and, with the ring off and
+then on, pipes a series of messages into the client binary, which sends them to a channel, while another member of the
+channel counts what it receives. Reports the messages per second delivered and the server CPU per message. Through the
+socket, messages sent in a burst may be read together and go out as a single chat line, the ring keeps every one of
+them apart.
+
+    python3 bench/ring_throughput.py --server build/server --client build/client --messages 200000
+"""
+
+import argparse
+import os
+import socket
+import subprocess
+import tempfile
+import threading
+import time
+
+
+def cpu_ms(pid):
+    fields = open(f"/proc/{pid}/stat").read().rsplit(")", 1)[1].split()
+    ticks = int(fields[11]) + int(fields[12])
+    return ticks * 1000 // os.sysconf("SC_CLK_TCK")
+
+
+def member(path, nick):
+    for _ in range(100):
+        try:
+            connection = socket.socket(socket.AF_UNIX)
+            connection.connect(path)
+            break
+        except (ConnectionRefusedError, FileNotFoundError):
+            connection.close()
+            time.sleep(0.05)
+    else:
+        raise RuntimeError("the server didn't come up")
+
+    connection.send(("/nick " + nick).encode())
+    time.sleep(0.05)
+    connection.send(b"/join #bench")
+    time.sleep(0.2)
+    connection.settimeout(0.2)
+    try:
+        while connection.recv(65536):
+            pass
+    except socket.timeout:
+        pass
+    return connection
+
+
+def measure(args, server, path, shm):
+    counter = member(path, f"counter-{shm}")
+    client = subprocess.Popen([args.client, f"--unix={path}", f"--shm={shm}", f"--nick=ring-{shm}"],
+                              stdin=subprocess.PIPE, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    client.stdin.write(b"/connect\n")
+    client.stdin.flush()
+    time.sleep(0.5)
+    client.stdin.write(b"/join #bench\n")
+    client.stdin.flush()
+    time.sleep(0.5)
+
+    # Every message ends with a marker, several of them may arrive in one frame
+    received = [0]
+    stop = False
+
+    def count():
+        while not stop:
+            try:
+                data = counter.recv(262144)
+            except socket.timeout:
+                continue
+            if not data:
+                break
+            received[0] += data.count(b"|")
+
+    thread = threading.Thread(target=count)
+    thread.start()
+
+    cpu_start = cpu_ms(server.pid)
+    started = time.time()
+    client.stdin.write(b"m|\n" * args.messages)
+    client.stdin.flush()
+
+    while received[0] < args.messages and time.time() - started < 120:
+        time.sleep(0.01)
+
+    elapsed = time.time() - started
+    cpu = cpu_ms(server.pid) - cpu_start
+    stop = True
+    thread.join()
+    client.stdin.close()
+    client.terminate()
+    client.wait()
+    counter.close()
+
+    return received[0], elapsed, cpu
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--server", required=True, help="server binary")
+    parser.add_argument("--client", required=True, help="client binary")
+    parser.add_argument("--port", type=int, default=24700)
+    parser.add_argument("--messages", type=int, default=200000)
+    parser.add_argument("--modes", default="off,on", help="ring settings of the client to compare")
+    parser.add_argument("server_args", nargs="*", help="extra server flags (after --)")
+    args = parser.parse_args()
+
+    # The counting member must not fall behind the limits of its outbound queue while the burst goes through
+    path = os.path.join(tempfile.mkdtemp(), "server.sock")
+    server = subprocess.Popen([args.server, str(args.port), "127.0.0.1", f"--unix={path}", "--shm=on",
+                               f"--outbound-max-messages={1 << 24}", f"--outbound-max-bytes={1 << 30}",
+                               *args.server_args],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        for shm in args.modes.split(","):
+            received, elapsed, cpu = measure(args, server, path, shm)
+
+            print(f"ring {shm}: delivered {received}/{args.messages} in {elapsed:.2f}s, "
+                  f"{received / elapsed:.0f} msg/s, server CPU {cpu * 1000 / max(received, 1):.2f}us per message")
+    finally:
+        server.terminate()
+        server.wait()
+        if os.path.exists(path):
+            os.unlink(path)
+        os.rmdir(os.path.dirname(path))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Messages per second and latency over a Unix socket against loopback TCP.
+
+Starts the server listening on both (with any extra flags given after `--`) and, for each transport, times a series of
+/ping round trips (p50/p99) and then has one client flood a channel for a while, keeping at most `--window` messages
+in flight, while another member of the channel counts what it receives.
+
+    python3 bench/unix_vs_tcp.py --server build/server --pings 20000 --seconds 5
+"""
+
+import argparse
+import os
+import select
+import socket
+import subprocess
+import tempfile
+import time
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))] if values else float("nan")
+
+
+def connect(address, nick):
+    family = socket.AF_UNIX if isinstance(address, str) else socket.AF_INET
+    for _ in range(100):
+        try:
+            connection = socket.socket(family)
+            connection.connect(address)
+            break
+        except (ConnectionRefusedError, FileNotFoundError):
+            connection.close()
+            time.sleep(0.05)
+    else:
+        raise RuntimeError("the server didn't come up")
+
+    if family == socket.AF_INET:
+        connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    connection.settimeout(1)
+    connection.send(("/nick " + nick).encode())
+    time.sleep(0.05)
+    connection.send(b"/join #bench")
+    time.sleep(0.05)
+    return connection
+
+
+def drain(connection):
+    connection.setblocking(False)
+    try:
+        while connection.recv(65536):
+            pass
+    except BlockingIOError:
+        pass
+
+
+def ping_latencies(connection, pings):
+    connection.setblocking(True)
+    connection.settimeout(1)
+    latencies = []
+    for i in range(pings):
+        started = time.perf_counter()
+        connection.send(b"/ping")
+        try:
+            connection.recv(64)
+        except socket.timeout:
+            continue
+
+        # Warm-up round trips don't count
+        if i >= pings // 10:
+            latencies.append(time.perf_counter() - started)
+
+    return latencies
+
+
+def flood(sender, receiver, seconds, window):
+    drain(sender)
+    drain(receiver)
+
+    # Every message ends with a marker, several of them may arrive in one frame
+    sent = 0
+    received = 0
+    deadline = time.time() + seconds
+    while time.time() < deadline:
+        writers = [sender] if sent - received < window else []
+        readable, writable, _ = select.select([sender, receiver], writers, [], 0.1)
+
+        for connection in readable:
+            try:
+                data = connection.recv(262144)
+            except BlockingIOError:
+                continue
+            if connection is receiver:
+                received += data.count(b"|")
+
+        if writable:
+            try:
+                sender.send(b"m|")
+                sent += 1
+            except BlockingIOError:
+                pass
+
+    return received / seconds
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--server", required=True, help="server binary")
+    parser.add_argument("--port", type=int, default=24600)
+    parser.add_argument("--pings", type=int, default=20000)
+    parser.add_argument("--seconds", type=float, default=5, help="flood duration of each transport")
+    parser.add_argument("--window", type=int, default=64, help="messages in flight during the flood")
+    parser.add_argument("server_args", nargs="*", help="extra server flags (after --)")
+    args = parser.parse_args()
+
+    path = os.path.join(tempfile.mkdtemp(), "server.sock")
+    server = subprocess.Popen([args.server, str(args.port), "127.0.0.1", f"--unix={path}", *args.server_args],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        for name, address in [("tcp", ("127.0.0.1", args.port)), ("unix", path)]:
+            sender = connect(address, name + "-sender")
+            receiver = connect(address, name + "-receiver")
+            time.sleep(0.2)
+            drain(sender)
+
+            latencies = ping_latencies(sender, args.pings)
+            rate = flood(sender, receiver, args.seconds, args.window)
+            sender.close()
+            receiver.close()
+
+            print(f"{name}: ping p50 {percentile(latencies, 0.5) * 1e6:.0f}us "
+                  f"p99 {percentile(latencies, 0.99) * 1e6:.0f}us, {rate:.0f} msg/s")
+    finally:
+        server.terminate()
+        server.wait()
+        if os.path.exists(path):
+            os.unlink(path)
+        os.rmdir(os.path.dirname(path))
+
+
+if __name__ == "__main__":
+    main()
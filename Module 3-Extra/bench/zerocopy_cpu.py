@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Server CPU per GB fanned out, with and without zero-copy sends.
+
+Starts the server with normal sends and then with `--zerocopy` (with any extra flags given after `--`), joins the given
+number of members to one channel, has one more member send a series of large messages and reports how much CPU the
+server used per GB delivered to the members. Over loopback the kernel copies zero-copy sends anyway and the server
+falls back to normal sends, run the members on another host (`--host`, the server listening on all addresses) to see
+the savings.
+
+    python3 bench/zerocopy_cpu.py --server build/server --members 200 --messages 2000 --size 4000 --zerocopy 2048
+"""
+
+import argparse
+import os
+import select
+import socket
+import subprocess
+import threading
+import time
+
+
+def cpu_ms(pid):
+    fields = open(f"/proc/{pid}/stat").read().rsplit(")", 1)[1].split()
+    ticks = int(fields[11]) + int(fields[12])
+    return ticks * 1000 // os.sysconf("SC_CLK_TCK")
+
+
+def measure(args, port, mode_args):
+    server = subprocess.Popen([args.server, str(port), args.listen, *mode_args, *args.server_args],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    time.sleep(0.5)
+
+    members = []
+    for i in range(args.members + 1):
+        s = socket.create_connection((args.host, port))
+        s.send(f"/nick u{i}".encode())
+        time.sleep(0.002)
+        s.send(b"/join #bench")
+        members.append(s)
+        time.sleep(0.002)
+    time.sleep(1)
+
+    # Drop whatever the commands answered before counting
+    for s in members:
+        s.setblocking(False)
+        try:
+            while s.recv(65536):
+                pass
+        except BlockingIOError:
+            pass
+
+    # The last one sends, what it gets back isn't counted
+    sender = members[-1]
+    received = [0]
+    stop = False
+
+    def reader():
+        poller = select.epoll()
+        by_fd = {s.fileno(): s for s in members}
+        for s in members:
+            poller.register(s, select.EPOLLIN)
+
+        while not stop:
+            for fd, _ in poller.poll(0.1):
+                try:
+                    while True:
+                        data = by_fd[fd].recv(262144)
+                        if not data:
+                            break
+                        if by_fd[fd] is not sender:
+                            received[0] += len(data)
+                except BlockingIOError:
+                    pass
+
+    thread = threading.Thread(target=reader)
+    thread.start()
+
+    payload = b"z" * args.size
+    expected = args.members * args.messages * args.size
+    cpu_start = cpu_ms(server.pid)
+    started = time.time()
+    for _ in range(args.messages):
+        select.select([], [sender], [])
+        sender.send(payload)
+        time.sleep(args.interval)
+
+    while received[0] < expected and time.time() - started < 120:
+        time.sleep(0.05)
+
+    elapsed = time.time() - started
+    cpu = cpu_ms(server.pid) - cpu_start
+    stop = True
+    thread.join()
+    server.terminate()
+    server.wait()
+
+    return received[0], elapsed, cpu
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--server", required=True, help="server binary")
+    parser.add_argument("--port", type=int, default=24300)
+    parser.add_argument("--host", default="127.0.0.1", help="address the members connect to")
+    parser.add_argument("--listen", default="127.0.0.1", help="address the server listens on")
+    parser.add_argument("--members", type=int, default=200)
+    parser.add_argument("--messages", type=int, default=2000)
+    parser.add_argument("--size", type=int, default=4000, help="message size (bytes)")
+    parser.add_argument("--interval", type=float, default=0.001, help="seconds between messages")
+    parser.add_argument("--zerocopy", type=int, default=2048, help="zero-copy threshold of the second run (bytes)")
+    parser.add_argument("server_args", nargs="*", help="extra server flags for both runs (after --)")
+    args = parser.parse_args()
+
+    for name, mode_args in [("copy", []), ("zero-copy", [f"--zerocopy={args.zerocopy}"])]:
+        received, elapsed, cpu = measure(args, args.port, mode_args)
+        args.port += 1
+
+        gigabytes = received / 1e9
+        per_gb = cpu / gigabytes if gigabytes > 0 else float("nan")
+        print(f"{name}: {received / 1e6:.0f} MB delivered in {elapsed:.2f}s, server CPU {cpu}ms, "
+              f"{per_gb:.0f}ms per GB")
+
+
+if __name__ == "__main__":
+    main()
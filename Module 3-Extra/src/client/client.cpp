@@ -29,6 +29,7 @@ int main(int argc, char *argv[]) {
 
     // Load host & port config from the command line
     state.config = config::parse_config(argc, argv);
+    state.waiter = wait::waiter_for(state.config.wait_profile, true);
 
     // Initiate manager thread and join it
     std::thread manager_thread(worker::client::manager, &state);
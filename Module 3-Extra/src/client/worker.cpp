@@ -2,6 +2,7 @@
 #include<chrono>
 #include<thread>
 
+#include<poll.h>
 #include<unistd.h>
 
 #include "../common/error.h"
@@ -10,24 +11,79 @@
 
 namespace worker::client {
 
+    // Offer the server a shared memory ring for the outgoing messages, over the new Unix socket connection, and wait
+    // for its answer. Returns false if it was refused (the messages go through the socket then).
+    static bool setup_ring(State *state, int socket_fd) {
+        if (!shmring::create(state->ring, config::SHM_RING_SIZE)) {
+            return false;
+        }
+
+        if (network::send_fds(socket_fd, config::SHM_MESSAGE, {state->ring.memfd, state->ring.event_fd,
+                                                                        state->ring.space_fd}) == 0) {
+            char buffer[config::MAX_MESSAGE_SIZE];
+            pollfd readable = {socket_fd, POLLIN, 0};
+
+            int result = -2;
+            if (poll(&readable, 1, (int) config::SHM_HANDSHAKE_TIMEOUT.count()) > 0) {
+                result = network::read_message(socket_fd, buffer);
+            }
+
+            if (result > 0 && std::string(buffer, result) == config::SHM_ACCEPTED) {
+                return true;
+            }
+        }
+
+        error::warning("Shared memory ring refused, sending through the socket");
+        shmring::release(state->ring);
+        return false;
+    }
+
     void handle_connect(State *state) {
         // Log connection start
-        std::cout << "\rConnecting to " << state->config.host << ":" << state->config.port << std::endl;
+        if (state->config.unix_paths.empty()) {
+            std::cout << "\rConnecting to " << state->config.host << ":" << state->config.port << std::endl;
+        } else {
+            std::cout << "\rConnecting to " << state->config.unix_paths[0] << std::endl;
+        }
+        // Identify right away if a nickname was given, the command goes along with the connection (in the SYN itself
+        // with fast open)
+        std::string first_message = state->config.nick.empty() ? "" : "/nick " + state->config.nick;
+
+        // With a shared memory ring, the handshake goes first and the first message through the ring
+        bool shm = state->config.shm && !state->config.unix_paths.empty();
+
         // Connect to the server with the given configuration
-        int socket_fd = network::connect(state->config);
+        state->connect_started = std::chrono::steady_clock::now();
+        int socket_fd = network::connect(state->config, shm ? "" : first_message);
 
         if (socket_fd == -1) {
             error::error("Failed to connect to the server!");
             return;
         }
 
+        if (shm) {
+            if (setup_ring(state, socket_fd)) {
+                std::cout << "\rSending through shared memory" << std::endl;
+            }
+
+            if (!first_message.empty()) {
+                auto guard = std::lock_guard<std::mutex>(state->message_queue_mutex);
+                state->pending_messages.push(first_message);
+            }
+        }
+
+        state->awaiting_first_response = !first_message.empty();
         state->socket_fd = socket_fd;
         std::cout << "\rConnected :)" << std::endl;
+
+        // The communicator waits for the connection
+        wait::wake(state->waiter);
     }
 
     void handle_quit(State *state) {
         error::warning("Closing connection");
         state->kill = true;
+        wait::wake(state->waiter);
     }
 
     void handle_message(std::string message, State *state) {
@@ -66,6 +122,9 @@ namespace worker::client {
                 state->pending_messages.push(sub_msg);
             }
         }
+
+        // Let the communicator know right away
+        wait::wake(state->waiter);
     }
 
     void manager(State *state) {
@@ -78,10 +137,11 @@ namespace worker::client {
     }
 
     void communicator(State *state) {
-        // Wait for a connection to be initiated
+        // Wait for a connection to be initiated (woken up by /connect and /quit)
         while (!state->kill && state->socket_fd == -1) {
-            std::this_thread::sleep_for(config::POLLING_INTERVAL);
+            wait::idle(state->waiter, -1);
         }
+        wait::reset(state->waiter);
 
         const int local_fd = state->socket_fd;
 
@@ -90,15 +150,25 @@ namespace worker::client {
 
         // Read/send messages from/to the connection
         while (!state->kill) {
+            bool idle = true;
+
             // Accept next incoming message, if present
-            if (communicator_incoming(state, buffer)) {
+            if (communicator_incoming(state, buffer, idle)) {
                 break;
             }
 
             // Send next pending message, if present
-            if (communicator_outgoing(state)) {
+            if (communicator_outgoing(state, idle)) {
                 break;
             }
+
+            // Nothing came in nor went out, wait a bit before polling again (spinning at first, then backing off). With
+            // the shared memory ring full, the server signalling some room cuts the wait short as well.
+            if (idle) {
+                wait::idle(state->waiter, state->socket_fd, state->ring_full ? state->ring.space_fd : -1);
+            } else {
+                wait::reset(state->waiter);
+            }
         }
 
         // Something happened that the connection was ended, let's kill the application then
@@ -134,16 +204,17 @@ namespace worker::client {
         }
     }
 
-    bool communicator_incoming(State *state, char buffer[]) {
+    bool communicator_incoming(State *state, char buffer[], bool &idle) {
         // Try getting the next pending message from the server
         int result = network::read_message(state->socket_fd, buffer);
 
-        // If there is no message available for now, sleep for a bit and try again
+        // If there is no message available for now, try again later
         if (result == -2) {
-            std::this_thread::sleep_for(config::POLLING_INTERVAL);
             return false;
         }
 
+        idle = false;
+
         // If there was an unrecoverable error from the communication, abort the listener
         if (result == -1) {
             return true;
@@ -155,9 +226,43 @@ namespace worker::client {
             return true;
         }
 
+        // Keepalive pings from the server are answered silently, wherever they are in what was read
+        std::string text = state->ping_carry + std::string(buffer, result);
+        state->ping_carry.clear();
+
+        bool pinged = false;
+        size_t at = text.find(config::PING_MESSAGE);
+        while (at != std::string::npos) {
+            text.erase(at, config::PING_MESSAGE.size());
+            pinged = true;
+            at = text.find(config::PING_MESSAGE, at);
+        }
+
+        // A ping cut by the end of the read, its start is held back for the next one
+        size_t start = text.rfind(config::PING_MESSAGE[0]);
+        if (start != std::string::npos && config::PING_MESSAGE.compare(0, text.size() - start, text, start) == 0) {
+            state->ping_carry = text.substr(start);
+            text.erase(start);
+        }
+
+        if (pinged) {
+            auto guard = std::lock_guard<std::mutex>(state->message_queue_mutex);
+            state->pending_messages.push(config::PONG_MESSAGE);
+        }
+
+        if (text.empty()) {
+            return false;
+        }
+
+        // How long the connection took to get its first message answered, handshake included
+        if (state->awaiting_first_response.exchange(false)) {
+            auto elapsed = std::chrono::steady_clock::now() - state->connect_started;
+            std::cout << "\rFirst response after " <<
+                      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << "us" << std::endl;
+        }
+
         // A new message from the server is available, print it :)
-        buffer[result] = '\0';
-        std::cout << "\r" << buffer << std::endl;
+        std::cout << "\r" << text << std::endl;
 
         // Print input caret back
         std::cout << "> ";
@@ -166,7 +271,7 @@ namespace worker::client {
         return false;
     }
 
-    bool communicator_outgoing(State *state) {
+    bool communicator_outgoing(State *state, bool &idle) {
         if (state->pending_messages.empty()) {
             return false;
         }
@@ -174,12 +279,35 @@ namespace worker::client {
         // Get front message from queue
         std::string message = state->pending_messages.front();
 
+        // Through the ring, no syscall at all unless the server is waiting for messages
+        if (state->ring.header != nullptr) {
+            size_t length = std::min(message.size(), (size_t) config::MAX_MESSAGE_SIZE);
+
+            // Ring full, the server is behind. The message stays at the front of the queue, and the communicator keeps
+            // reading the socket (noticing a closed connection) while it waits for the server to free some room.
+            state->ring_full = !shmring::write(state->ring, message.data(), length);
+            if (state->ring_full) {
+                shmring::want_space(state->ring);
+                state->ring_full = !shmring::write(state->ring, message.data(), length);
+            }
+
+            if (state->ring_full) {
+                return false;
+            }
+        }
+
+        idle = false;
+
         // Acquire lock and remove front message from queue
         {
             auto guard = std::lock_guard<std::mutex>(state->message_queue_mutex);
             state->pending_messages.pop();
         }
 
+        if (state->ring.header != nullptr) {
+            return false;
+        }
+
         // Try sending
         int tries = 0;
 
@@ -188,8 +316,12 @@ namespace worker::client {
             int result = network::send_message(state->socket_fd, const_cast<char *>(message.c_str()),
                                                (int) std::min(message.size(), (size_t) config::MAX_MESSAGE_SIZE));
 
-            // Failed to send the message (likely a timeout)
+            // The send buffer is full, wait for the server to drain it (a wake-up just checks for a /quit)
             if (result == -2) {
+                if (wait::writable(state->waiter, state->socket_fd, config::SEND_WAIT)) {
+                    continue;
+                }
+
                 tries++;
 
                 // Exceeded maximum tries, connection must be dead
@@ -198,8 +330,6 @@ namespace worker::client {
                     return true;
                 }
 
-                // Cool down for a little bit
-                std::this_thread::sleep_for(config::POLLING_INTERVAL);
                 continue;
             }
 
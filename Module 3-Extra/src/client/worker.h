@@ -1,5 +1,6 @@
 #pragma once
 
+#include<chrono>
 #include<vector>
 
 #include<unistd.h>
@@ -8,6 +9,8 @@
 #include <queue>
 
 #include "../common/network.h"
+#include "../common/shmring.h"
+#include "../common/wait.h"
 
 namespace worker::client {
     struct State {
@@ -17,6 +20,21 @@ namespace worker::client {
 
         std::mutex message_queue_mutex;
         std::queue<std::string> pending_messages;
+
+        // Wait strategy of the communicator, woken up by the input thread when there are new messages to send
+        wait::Waiter waiter;
+
+        // When the connection started, and whether the answer to its first message (--nick) is still to come
+        std::chrono::steady_clock::time_point connect_started;
+        std::atomic<bool> awaiting_first_response;
+
+        // Tail of the last read that may be the start of a keepalive ping cut in two (communicator only)
+        std::string ping_carry;
+
+        // Shared memory ring the messages are sent through, if the server took it (header is null otherwise), and
+        // whether the next message is waiting for room in it (communicator only)
+        shmring::Ring ring;
+        bool ring_full;
     };
 
     void manager(State *state);
@@ -25,9 +43,10 @@ namespace worker::client {
 
     void communicator(State *state);
 
-    bool communicator_outgoing(State *state);
+    // Both return true if the connection should be closed, and clear `idle` if they did anything
+    bool communicator_outgoing(State *state, bool &idle);
 
-    bool communicator_incoming(State *state, char buffer[]);
+    bool communicator_incoming(State *state, char buffer[], bool &idle);
 
     void handle_message(std::string message, State *state);
 
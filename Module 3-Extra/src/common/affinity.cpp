@@ -0,0 +1,149 @@
+#include<cctype>
+#include<cstdlib>
+#include<fstream>
+#include<iostream>
+#include<sstream>
+
+#include<dirent.h>
+#include<pthread.h>
+#include<sched.h>
+
+#include "error.h"
+#include "affinity.h"
+
+namespace affinity {
+    static const std::string NODES_PATH = "/sys/devices/system/node";
+    static const std::string CPUS_PATH = "/sys/devices/system/cpu";
+
+    bool parse_cpu_list(const std::string &list, std::vector<int> &cpus) {
+        std::stringstream stream(list);
+        std::string range;
+
+        while (std::getline(stream, range, ',')) {
+            char *end = nullptr;
+            long first = std::strtol(range.c_str(), &end, 10);
+            long last = first;
+
+            if (end == range.c_str()) {
+                return false;
+            }
+
+            if (*end == '-') {
+                const char *start = end + 1;
+                last = std::strtol(start, &end, 10);
+
+                if (end == start) {
+                    return false;
+                }
+            }
+
+            if (*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+                return false;
+            }
+
+            for (long cpu = first; cpu <= last; cpu++) {
+                cpus.push_back((int) cpu);
+            }
+        }
+
+        return !cpus.empty();
+    }
+
+    std::vector<int> pool_cpus(const std::vector<int> &cpus, unsigned int index) {
+        if (cpus.empty()) {
+            return {};
+        }
+
+        return {cpus[index % cpus.size()]};
+    }
+
+    bool pin_thread(const std::vector<int> &cpus) {
+        if (cpus.empty()) {
+            return true;
+        }
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu: cpus) {
+            CPU_SET(cpu, &set);
+        }
+
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (result != 0) {
+            error::warning("Failed to pin a thread to its CPUs, it will run unpinned");
+            return false;
+        }
+
+        return true;
+    }
+
+    int cpu_node(int cpu) {
+        // The CPU directory holds a `nodeN` link to its NUMA node
+        std::string path = CPUS_PATH + "/cpu" + std::to_string(cpu);
+        DIR *dir = opendir(path.c_str());
+        if (dir == nullptr) {
+            return -1;
+        }
+
+        int node = -1;
+        while (dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::isdigit(name[4])) {
+                node = std::atoi(name.c_str() + 4);
+                break;
+            }
+        }
+
+        closedir(dir);
+        return node;
+    }
+
+    void report_topology() {
+        DIR *dir = opendir(NODES_PATH.c_str());
+        if (dir == nullptr) {
+            std::cout << "Topology: NUMA information unavailable" << std::endl;
+            return;
+        }
+
+        std::cout << "Topology:";
+        while (dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() <= 4 || name.compare(0, 4, "node") != 0 || !std::isdigit(name[4])) {
+                continue;
+            }
+
+            std::string cpulist;
+            std::ifstream file(NODES_PATH + "/" + name + "/cpulist");
+            std::getline(file, cpulist);
+
+            std::cout << " " << name << " (cpus " << cpulist << ")";
+        }
+        std::cout << std::endl;
+
+        closedir(dir);
+    }
+
+    void report_placement(const std::string &pool, const std::vector<int> &cpus, unsigned int threads, bool shared) {
+        if (threads == 0) {
+            return;
+        }
+
+        std::cout << "Placement: " << pool << " x" << threads << ":";
+
+        if (cpus.empty()) {
+            std::cout << " unpinned" << std::endl;
+            return;
+        }
+
+        for (unsigned int i = 0; i < threads; i++) {
+            std::vector<int> placed = shared ? cpus : pool_cpus(cpus, i);
+
+            std::cout << " [";
+            for (size_t j = 0; j < placed.size(); j++) {
+                std::cout << (j > 0 ? "," : "") << "cpu" << placed[j] << "/node" << cpu_node(placed[j]);
+            }
+            std::cout << "]";
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include<string>
+#include<vector>
+
+namespace affinity {
+    // Parse a CPU list (e.g. `0-3,8`), returns false if it is malformed
+    bool parse_cpu_list(const std::string &list, std::vector<int> &cpus);
+
+    // CPU of the index'th thread of a pool, the threads are spread round-robin over the list (empty if not pinned)
+    std::vector<int> pool_cpus(const std::vector<int> &cpus, unsigned int index);
+
+    // Pin the calling thread to the given CPUs (no-op if empty), returns false if the kernel refused it
+    bool pin_thread(const std::vector<int> &cpus);
+
+    // NUMA node of a CPU (-1 if unknown)
+    int cpu_node(int cpu);
+
+    // Print the NUMA nodes of the machine and their CPUs
+    void report_topology();
+
+    // Print where the threads of a pool are placed
+    void report_placement(const std::string &pool, const std::vector<int> &cpus, unsigned int threads, bool shared);
+}
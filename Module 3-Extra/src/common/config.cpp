@@ -1,13 +1,151 @@
 #include <iostream>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "affinity.h"
 #include "config.h"
 
 namespace config {
+    // Check if a CLI arg is an optional `--name=value` flag
+    static bool is_flag(const char *arg) {
+        return std::strncmp(arg, "--", 2) == 0;
+    }
+
+    // Look up the value of the `--name=value` flag, nullptr if absent
+    static const char *find_flag(int argc, char *argv[], const std::string &name) {
+        std::string prefix = "--" + name + "=";
+
+        for (int i = 1; i < argc; i++) {
+            if (std::strncmp(argv[i], prefix.c_str(), prefix.size()) == 0) {
+                return argv[i] + prefix.size();
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Parse an unsigned flag, exiting on invalid values
+    static unsigned long long parse_uint_flag(int argc, char *argv[], const std::string &name,
+                                              unsigned long long default_value, unsigned long long max_value) {
+        const char *raw = find_flag(argc, argv, name);
+        if (raw == nullptr) {
+            return default_value;
+        }
+
+        char *end = nullptr;
+        unsigned long long value = std::strtoull(raw, &end, 10);
+        if (*raw == '\0' || *end != '\0' || value > max_value) {
+            std::cerr << "Error: invalid value for --" << name << std::endl;
+            std::exit(1);
+        }
+
+        return value;
+    }
+
+    // Parse a flag restricted to a set of named values, exiting on invalid ones
+    template<typename T>
+    static T parse_choice_flag(int argc, char *argv[], const std::string &name, T default_value,
+                               const std::vector<std::pair<std::string, T> > &choices) {
+        const char *raw = find_flag(argc, argv, name);
+        if (raw == nullptr) {
+            return default_value;
+        }
+
+        for (const auto &choice: choices) {
+            if (choice.first == raw) {
+                return choice.second;
+            }
+        }
+
+        std::cerr << "Error: invalid value for --" << name << std::endl;
+        std::exit(1);
+    }
+
+    // Parse a CPU list flag (e.g. `--io-cpus=0-3,8`), exiting on invalid lists
+    static std::vector<int> parse_cpus_flag(int argc, char *argv[], const std::string &name) {
+        std::vector<int> cpus;
+
+        const char *raw = find_flag(argc, argv, name);
+        if (raw != nullptr && !affinity::parse_cpu_list(raw, cpus)) {
+            std::cerr << "Error: invalid CPU list for --" << name << std::endl;
+            std::exit(1);
+        }
+
+        return cpus;
+    }
+
+    // Parse a comma separated list flag (e.g. `--unix=/tmp/a.sock,/tmp/b.sock`), exiting on empty entries
+    static std::vector<std::string> parse_list_flag(int argc, char *argv[], const std::string &name) {
+        std::vector<std::string> entries;
+
+        const char *raw = find_flag(argc, argv, name);
+        if (raw == nullptr) {
+            return entries;
+        }
+
+        std::string list = raw;
+        size_t start = 0;
+        while (true) {
+            size_t end = list.find(',', start);
+            entries.push_back(list.substr(start, end == std::string::npos ? std::string::npos : end - start));
+
+            if (entries.back().empty()) {
+                std::cerr << "Error: invalid value for --" << name << std::endl;
+                std::exit(1);
+            }
+
+            if (end == std::string::npos) {
+                return entries;
+            }
+            start = end + 1;
+        }
+    }
+
+    static WaitProfile parse_wait_flag(int argc, char *argv[], unsigned int busy_poll) {
+        // Busy-poll mode never sleeps
+        if (busy_poll > 0) {
+            return WaitProfile::BUSY;
+        }
+
+        return parse_choice_flag<WaitProfile>(argc, argv, "wait", WaitProfile::CPU, {
+                {"latency", WaitProfile::LATENCY},
+                {"cpu",     WaitProfile::CPU},
+                {"busy",    WaitProfile::BUSY},
+        });
+    }
+
     ConnectionConfig parse_config(int argc, char *argv[]) {
         ConnectionConfig config = {DEFAULT_HOST, DEFAULT_PORT};
 
+        config.busy_poll = (unsigned int) parse_uint_flag(argc, argv, "busy-poll", 0, 1 << 20);
+        config.wait_profile = parse_wait_flag(argc, argv, config.busy_poll);
+        config.fast_open = parse_choice_flag<bool>(argc, argv, "fast-open", false, {
+                {"on",  true},
+                {"off", false},
+        });
+
+        const char *nick = find_flag(argc, argv, "nick");
+        if (nick != nullptr) {
+            config.nick = nick;
+        }
+
+        config.unix_paths = parse_list_flag(argc, argv, "unix");
+        config.shm = parse_choice_flag<bool>(argc, argv, "shm", false, {
+                {"on",  true},
+                {"off", false},
+        });
+
+        // Positional args (flags are handled separately)
+        std::vector<char *> args;
+        for (int i = 1; i < argc; i++) {
+            if (!is_flag(argv[i])) {
+                args.push_back(argv[i]);
+            }
+        }
+
         // Parse port from the CLI args
-        if (argc > 1) {
-            int port_raw = std::atoi(argv[1]);
+        if (args.size() > 0) {
+            int port_raw = std::atoi(args[0]);
             if (port_raw < 0 || port_raw > 65535) {
                 std::cerr << "Error: port out of bounds" << std::endl;
                 std::exit(1);
@@ -17,11 +155,183 @@ namespace config {
         }
 
         // Parse host from the CLI args
-        if (argc > 2) {
-            std::string host = argv[2];
+        if (args.size() > 1) {
+            std::string host = args[1];
             config.host = host;
         }
 
         return config;
     }
+
+    ServerConfig parse_server_config(int argc, char *argv[]) {
+        ServerConfig config{};
+
+        config.io_threads = (unsigned int) parse_uint_flag(argc, argv, "io-threads", DEFAULT_IO_THREADS, 1024);
+        config.busy_poll = (unsigned int) parse_uint_flag(argc, argv, "busy-poll", 0, 1 << 20);
+        config.wait_profile = parse_wait_flag(argc, argv, config.busy_poll);
+        config.defer_accept = (unsigned int) parse_uint_flag(argc, argv, "defer-accept", 0, 1 << 20);
+        config.socket_profile = parse_choice_flag<SocketProfile>(argc, argv, "socket-profile", SocketProfile::DEFAULT, {
+                {"default",    SocketProfile::DEFAULT},
+                {"latency",    SocketProfile::LATENCY},
+                {"throughput", SocketProfile::THROUGHPUT},
+                {"adaptive",   SocketProfile::ADAPTIVE},
+        });
+        config.read_budget = (unsigned int) parse_uint_flag(argc, argv, "read-budget", DEFAULT_READ_BUDGET, 1 << 20);
+        config.write_budget = (size_t) parse_uint_flag(argc, argv, "write-budget", DEFAULT_WRITE_BUDGET, 1ull << 40);
+        config.zerocopy = (size_t) parse_uint_flag(argc, argv, "zerocopy", 0, 1ull << 40);
+        config.shm = parse_choice_flag<bool>(argc, argv, "shm", false, {
+                {"on",  true},
+                {"off", false},
+        });
+        config.handler_threads = (unsigned int) parse_uint_flag(argc, argv, "handlers", DEFAULT_HANDLER_THREADS, 1024);
+        config.handler_queue_capacity = (size_t) parse_uint_flag(argc, argv, "handler-queue",
+                                                                 DEFAULT_HANDLER_QUEUE_CAPACITY, 1 << 24);
+        config.delivery = parse_choice_flag<Delivery>(argc, argv, "delivery", Delivery::QUEUE, {
+                {"queue", Delivery::QUEUE},
+                {"log",   Delivery::LOG},
+        });
+        config.channel_log_size = (size_t) parse_uint_flag(argc, argv, "channel-log", DEFAULT_CHANNEL_LOG_SIZE,
+                                                           1 << 24);
+        config.fanout_threshold = (size_t) parse_uint_flag(argc, argv, "fanout-threshold", DEFAULT_FANOUT_THRESHOLD,
+                                                           1 << 24);
+        config.fanout_threads = (unsigned int) parse_uint_flag(argc, argv, "fanout-threads", DEFAULT_FANOUT_THREADS,
+                                                               1024);
+
+        config.idle_timeout = std::chrono::seconds(
+                parse_uint_flag(argc, argv, "idle-timeout", DEFAULT_IDLE_TIMEOUT, 1 << 24));
+        config.ping_interval = std::chrono::seconds(
+                parse_uint_flag(argc, argv, "ping-interval", DEFAULT_PING_INTERVAL, 1 << 24));
+        config.ping_timeout = std::chrono::seconds(
+                parse_uint_flag(argc, argv, "ping-timeout", DEFAULT_PING_TIMEOUT, 1 << 24));
+        config.invite_timeout = std::chrono::seconds(
+                parse_uint_flag(argc, argv, "invite-timeout", DEFAULT_INVITE_TIMEOUT, 1 << 24));
+
+        config.keepalive.idle = (unsigned int) parse_uint_flag(argc, argv, "tcp-keepidle", 0, 1 << 15);
+        config.keepalive.interval = (unsigned int) parse_uint_flag(argc, argv, "tcp-keepintvl", 0, 1 << 15);
+        config.keepalive.count = (unsigned int) parse_uint_flag(argc, argv, "tcp-keepcnt", 0, 127);
+        config.keepalive.user_timeout = (unsigned int) parse_uint_flag(argc, argv, "tcp-user-timeout", 0, 1 << 30);
+
+        config.outbound.max_messages = (size_t) parse_uint_flag(argc, argv, "outbound-max-messages",
+                                                                DEFAULT_OUTBOUND_MAX_MESSAGES, 1 << 24);
+        config.outbound.max_bytes = (size_t) parse_uint_flag(argc, argv, "outbound-max-bytes",
+                                                             DEFAULT_OUTBOUND_MAX_BYTES, 1ull << 40);
+        config.outbound.policy = parse_choice_flag<SlowConsumerPolicy>(
+                argc, argv, "slow-consumer", SlowConsumerPolicy::DISCONNECT, {
+                        {"disconnect",  SlowConsumerPolicy::DISCONNECT},
+                        {"drop-oldest", SlowConsumerPolicy::DROP_OLDEST},
+                        {"drop-new",    SlowConsumerPolicy::DROP_NEW},
+                });
+
+        config.rate_limits.chat_rate = (unsigned int) parse_uint_flag(argc, argv, "chat-rate", DEFAULT_CHAT_RATE,
+                                                                      1 << 20);
+        config.rate_limits.chat_burst = (unsigned int) parse_uint_flag(argc, argv, "chat-burst", DEFAULT_CHAT_BURST,
+                                                                       1 << 20);
+        config.rate_limits.command_rate = (unsigned int) parse_uint_flag(argc, argv, "command-rate",
+                                                                         DEFAULT_COMMAND_RATE, 1 << 20);
+        config.rate_limits.command_burst = (unsigned int) parse_uint_flag(argc, argv, "command-burst",
+                                                                          DEFAULT_COMMAND_BURST, 1 << 20);
+
+        config.overload.handler_queue = (size_t) parse_uint_flag(argc, argv, "overload-queue", DEFAULT_OVERLOAD_QUEUE,
+                                                                 1 << 24);
+        config.overload.outbound_bytes = (size_t) parse_uint_flag(argc, argv, "overload-outbound-bytes",
+                                                                  DEFAULT_OVERLOAD_OUTBOUND_BYTES, 1ull << 40);
+        config.overload.loop_lag = std::chrono::milliseconds(
+                parse_uint_flag(argc, argv, "overload-lag", DEFAULT_OVERLOAD_LAG, 1 << 24));
+
+        config.affinity.acceptor = parse_cpus_flag(argc, argv, "acceptor-cpus");
+        config.affinity.io = parse_cpus_flag(argc, argv, "io-cpus");
+        config.affinity.handler = parse_cpus_flag(argc, argv, "handler-cpus");
+        config.placement = parse_choice_flag<Placement>(argc, argv, "placement", Placement::ROUND_ROBIN, {
+                {"round-robin", Placement::ROUND_ROBIN},
+                {"channel",     Placement::CHANNEL},
+        });
+        config.rebalance_threshold = (unsigned int) parse_uint_flag(argc, argv, "rebalance",
+                                                                    DEFAULT_REBALANCE_THRESHOLD, 100);
+
+        const char *rate_limits_file = find_flag(argc, argv, "rate-limits");
+        if (rate_limits_file != nullptr) {
+            config.rate_limits_file = rate_limits_file;
+
+            if (!load_rate_limits(config.rate_limits_file, config.rate_limits)) {
+                std::exit(1);
+            }
+        }
+
+        if (config.io_threads == 0) {
+            std::cerr << "Error: --io-threads must be positive" << std::endl;
+            std::exit(1);
+        }
+
+        if (config.outbound.max_messages == 0 || config.outbound.max_bytes < MAX_MESSAGE_SIZE) {
+            std::cerr << "Error: outbound queue limits are too small" << std::endl;
+            std::exit(1);
+        }
+
+        if (config.handler_queue_capacity == 0) {
+            std::cerr << "Error: --handler-queue must be positive" << std::endl;
+            std::exit(1);
+        }
+
+        if (config.channel_log_size == 0) {
+            std::cerr << "Error: --channel-log must be positive" << std::endl;
+            std::exit(1);
+        }
+
+        return config;
+    }
+
+    bool load_rate_limits(const std::string &path, RateLimitConfig &limits) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Error: failed to open the rate limits file " << path << std::endl;
+            return false;
+        }
+
+        const std::vector<std::pair<std::string, unsigned int RateLimitConfig::*> > fields = {
+                {"chat-rate",     &RateLimitConfig::chat_rate},
+                {"chat-burst",    &RateLimitConfig::chat_burst},
+                {"command-rate",  &RateLimitConfig::command_rate},
+                {"command-burst", &RateLimitConfig::command_burst},
+        };
+
+        RateLimitConfig loaded = limits;
+        std::string line;
+        int line_number = 0;
+
+        while (std::getline(file, line)) {
+            line_number++;
+
+            // Drop comments and blanks
+            line = line.substr(0, line.find('#'));
+            line.erase(0, line.find_first_not_of(" \t\r"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.empty()) {
+                continue;
+            }
+
+            size_t separator = line.find('=');
+            std::string name = line.substr(0, separator);
+            std::string raw = separator == std::string::npos ? "" : line.substr(separator + 1);
+
+            char *end = nullptr;
+            unsigned long long value = std::strtoull(raw.c_str(), &end, 10);
+            bool valid = !raw.empty() && *end == '\0' && value <= (1 << 20);
+
+            bool known = false;
+            for (const auto &field: fields) {
+                if (field.first == name && valid) {
+                    loaded.*field.second = (unsigned int) value;
+                    known = true;
+                }
+            }
+
+            if (!known) {
+                std::cerr << "Error: invalid rate limit at " << path << ":" << line_number << std::endl;
+                return false;
+            }
+        }
+
+        limits = loaded;
+        return true;
+    }
 }
@@ -5,6 +5,7 @@
 #include <stdexcept>
 #include <cinttypes>
 #include <limits>
+#include <vector>
 
 namespace config {
     static const uint16_t MAX_MESSAGE_SIZE = 4096;
@@ -24,17 +25,312 @@ namespace config {
             .tv_usec = 0,
     };
 
-    // Polling interval of 0.1ms
-    static const std::chrono::duration POLLING_INTERVAL = std::chrono::microseconds(100);
+    // How long a full send buffer is waited on before counting a failed send try
+    static const std::chrono::duration SEND_WAIT = std::chrono::milliseconds(1000);
 
     // Max send tries
     static const int MAX_SEND_TRIES = 5;
 
+    // How polling threads wait once there is nothing to do: spinning keeps the latency down, parking saves CPU and
+    // busy polling never gives the CPU up (busy-poll mode)
+    enum class WaitProfile {
+        LATENCY,
+        CPU,
+        BUSY,
+    };
+
+    // Event loop threads multiplexing the client connections
+    static const unsigned int DEFAULT_IO_THREADS = 1;
+
+    // Fast Open connections the listener may have waiting for their handshake to complete (TCP_FASTOPEN)
+    static const int FAST_OPEN_QUEUE = 256;
+
+    // Max connections accepted in a row before they are handed over to the event loops
+    static const size_t ACCEPT_BATCH = 64;
+
+    // Max events handled per event loop poll
+    static const int LOOP_MAX_EVENTS = 64;
+
+    // Max time an idle event loop blocks before re-checking the kill flag
+    static const std::chrono::milliseconds LOOP_WAIT_INTERVAL = std::chrono::milliseconds(100);
+
+    // Resolution of the event loop timers
+    static const std::chrono::milliseconds TIMER_TICK = std::chrono::milliseconds(10);
+
+    // Interval between sweeps of dead clients from the server tables
+    static const std::chrono::milliseconds REAP_INTERVAL = std::chrono::seconds(1);
+
+    // Connections without any inbound frame for this long are closed (0 disables it)
+    static const unsigned int DEFAULT_IDLE_TIMEOUT = 300;
+
+    // Silent connections are pinged by the server after this long (0 disables it)
+    static const unsigned int DEFAULT_PING_INTERVAL = 60;
+
+    // Keepalive pings left unanswered for this long tear the connection down (0 disables it)
+    static const unsigned int DEFAULT_PING_TIMEOUT = 20;
+
+    // Channel invites are dropped after this long (0 makes them permanent)
+    static const unsigned int DEFAULT_INVITE_TIMEOUT = 600;
+
+    // Limits of each client outbound queue
+    static const size_t DEFAULT_OUTBOUND_MAX_MESSAGES = 1024;
+    static const size_t DEFAULT_OUTBOUND_MAX_BYTES = 1 << 20;
+
+    // Control messages sent ahead of waiting channel messages before a channel message gets a turn
+    static const unsigned int CONTROL_BURST = 16;
+
+    // Inbound rate limits of each client, in lines per second and max burst (0 disables the limit). Off unless the
+    // operator sets a rate, the bursts apply once it does.
+    static const unsigned int DEFAULT_CHAT_RATE = 0;
+    static const unsigned int DEFAULT_CHAT_BURST = 20;
+    static const unsigned int DEFAULT_COMMAND_RATE = 0;
+    static const unsigned int DEFAULT_COMMAND_BURST = 10;
+
+    // Overload thresholds, past them the server starts shedding load (0 disables each of them). All off unless the
+    // operator sets them, the signals are still sampled for the metrics.
+    static const size_t DEFAULT_OVERLOAD_QUEUE = 0;
+    static const size_t DEFAULT_OVERLOAD_OUTBOUND_BYTES = 0;
+    static const unsigned int DEFAULT_OVERLOAD_LAG = 0;
+
+    // How often the overload controller samples the server
+    static const std::chrono::duration OVERLOAD_INTERVAL = std::chrono::milliseconds(100);
+
+    // Share of the active senders paused once the server is overloaded (1 in N, at least one)
+    static const size_t OVERLOAD_PAUSE_SHARE = 10;
+
+    // Loop imbalance (busy share of the busiest loop minus the idlest one's, in % of the time) past which connections
+    // are moved from one to the other (0 disables the rebalancer)
+    static const unsigned int DEFAULT_REBALANCE_THRESHOLD = 20;
+
+    // How often the rebalancer samples the loops, and how many connections (or channels) it moves each time at most
+    static const std::chrono::duration REBALANCE_INTERVAL = std::chrono::seconds(1);
+    static const size_t REBALANCE_MAX_MOVES = 8;
+
+    // How long a migration waits before trying again when broadcast messages for the connection are still on their
+    // way through its loop mailbox
+    static const std::chrono::duration MIGRATE_RETRY = std::chrono::milliseconds(1);
+
+    // What a connection may use of each event loop pass before the other connections get their turn (frames read and
+    // bytes sent, 0 disables the budget)
+    static const unsigned int DEFAULT_READ_BUDGET = 8;
+    static const size_t DEFAULT_WRITE_BUDGET = 32 << 10;
+
+    // Buffers of zero-copy sends still unacknowledged when their connection closes are held for this long before being
+    // released (the kernel may still read them, and no completion comes after the close)
+    static const std::chrono::milliseconds ZEROCOPY_LINGER = std::chrono::seconds(30);
+
+    // Socket tuning of the connections: kernel defaults, low latency (a small unsent backlog in the kernel, so queued
+    // messages wait in the outbound queues where they are prioritized or dropped, and no Nagle), high throughput (big
+    // buffers and full segments) or adaptive (latency at first, throughput for the connections receiving the most)
+    enum class SocketProfile {
+        DEFAULT,
+        LATENCY,
+        THROUGHPUT,
+        ADAPTIVE,
+    };
+
+    // Socket options of a profile, zeroes keep the kernel defaults (autotuned buffers, no unsent limit)
+    struct SocketTuning {
+        int send_buffer;
+        int receive_buffer;
+        // Unsent bytes past which the socket stops taking more (TCP_NOTSENT_LOWAT)
+        int notsent_lowat;
+        bool nodelay;
+        // Cork the socket while a flush sends several messages, so they leave in full segments
+        bool cork;
+    };
+
+    static const SocketTuning LATENCY_TUNING = {0, 0, 16 << 10, true, false};
+    static const SocketTuning THROUGHPUT_TUNING = {1 << 20, 1 << 20, 0, false, true};
+
+    // Adaptive profile: connections sent more than this (bytes/s) over an interval switch to the throughput settings,
+    // and back under a quarter of it
+    static const uint64_t ADAPTIVE_BULK_RATE = 1 << 20;
+    static const std::chrono::duration TUNING_INTERVAL = std::chrono::seconds(1);
+
+    // Shared memory rings of same-host clients: the handshake frame (sent along with the ring fds over the Unix
+    // socket), the server answers, the ring capacity and how long the client waits for the answer
+    static const std::string SHM_MESSAGE = "/shm";
+    static const std::string SHM_ACCEPTED = "Shared memory ring attached";
+    static const std::string SHM_REFUSED = "Shared memory ring refused";
+    static const uint32_t SHM_RING_SIZE = 1 << 20;
+    static const std::chrono::milliseconds SHM_HANDSHAKE_TIMEOUT = std::chrono::seconds(1);
+    // Most fds a frame may carry (the ring memfd and eventfds)
+    static const size_t MAX_PASSED_FDS = 3;
+
+    // Keepalive frames exchanged between server and client. Messages have no framing and the ping may come merged with
+    // channel traffic, so it is delimited (like CTCP) to be picked out of whatever the client reads.
+    static const std::string PING_MESSAGE = "\x01PING\x01";
+    static const std::string PONG_MESSAGE = "/pong";
+
+    // Handler threads for the pipeline mode (0 keeps command handling on the I/O threads)
+    static const unsigned int DEFAULT_HANDLER_THREADS = 0;
+
+    // Max commands waiting for the handler threads before the I/O threads are held back
+    static const size_t DEFAULT_HANDLER_QUEUE_CAPACITY = 1024;
+
+    // Messages kept by each channel for its members to read (log delivery mode)
+    static const size_t DEFAULT_CHANNEL_LOG_SIZE = 1024;
+
+    // Broadcasts to channels bigger than the threshold are split into chunks, fanned out in parallel on the handler
+    // threads (or on the fan-out threads without the pipeline mode)
+    static const size_t DEFAULT_FANOUT_THRESHOLD = 1024;
+    static const size_t FANOUT_CHUNK_SIZE = 256;
+    static const unsigned int DEFAULT_FANOUT_THREADS = 2;
+
+    // How long a blocked queue waits before re-checking the kill flag
+    static const std::chrono::duration QUEUE_WAIT_INTERVAL = std::chrono::milliseconds(10);
+
     struct ConnectionConfig {
         std::string host;
         std::uint16_t port;
         bool blocking;
+        // Wait strategy of the polling threads (client communicator, server acceptor)
+        WaitProfile wait_profile;
+        // Busy-poll mode, spinning for this long on the socket (SO_BUSY_POLL, us) and never sleeping (0 disables it)
+        unsigned int busy_poll;
+        // TCP Fast Open: the client's first message rides in the SYN, the server accepts such connections
+        bool fast_open;
+        // Nickname the client identifies with as soon as it connects (client only, empty for none)
+        std::string nick;
+        // Unix domain socket paths for same-host clients: the server listens on every one of them besides the TCP
+        // address, the client connects to the first one instead of the TCP address
+        std::vector<std::string> unix_paths;
+        // The client sends its messages through a shared memory ring (over a Unix socket only)
+        bool shm;
+    };
+
+    // What to do when a client outbound queue is full
+    enum class SlowConsumerPolicy {
+        // Disconnect the client
+        DISCONNECT,
+        // Drop the oldest queued messages (channel messages first)
+        DROP_OLDEST,
+        // Drop the new message, unless it is a control message (direct responses)
+        DROP_NEW,
+    };
+
+    struct OutboundConfig {
+        size_t max_messages;
+        size_t max_bytes;
+        SlowConsumerPolicy policy;
+    };
+
+    // Token buckets of the client inbound lines, chat lines and commands (`/...`) are paced separately
+    struct RateLimitConfig {
+        // Lines per second (0 disables the limit)
+        unsigned int chat_rate;
+        // Lines allowed at once, after a quiet period
+        unsigned int chat_burst;
+        unsigned int command_rate;
+        unsigned int command_burst;
+    };
+
+    // Overload thresholds (0 disables each signal)
+    struct OverloadConfig {
+        // Commands waiting for the handler threads
+        size_t handler_queue;
+        // Bytes waiting on every client outbound queue
+        size_t outbound_bytes;
+        // Delay of work posted to the event loops
+        std::chrono::milliseconds loop_lag;
+    };
+
+    // How channel messages reach the members: copied into each member's outbound queue, or appended once to the
+    // channel log that every member reads from its own cursor
+    enum class Delivery {
+        QUEUE,
+        LOG,
+    };
+
+    // Which event loop serves a connection: the one it was accepted on (round-robin) or, once it joins a channel, the
+    // one owning the channel (its members share a loop, so broadcasts mostly stay on one core)
+    enum class Placement {
+        ROUND_ROBIN,
+        CHANNEL,
+    };
+
+    // CPUs each kind of server thread is pinned to (empty lists leave the threads unpinned). The I/O and handler
+    // threads are spread one per CPU, round-robin, the acceptor may run on any of its CPUs.
+    struct AffinityConfig {
+        std::vector<int> acceptor;
+        std::vector<int> io;
+        std::vector<int> handler;
+    };
+
+    // Kernel keepalive of accepted connections (zeroed fields keep the system defaults)
+    struct KeepaliveConfig {
+        // Idle time before the first TCP keepalive probe (s), 0 leaves SO_KEEPALIVE off
+        unsigned int idle;
+        // Time between probes (s)
+        unsigned int interval;
+        // Unanswered probes before the connection is dropped
+        unsigned int count;
+        // Max time sent data may stay unacknowledged before the connection is dropped (ms, TCP_USER_TIMEOUT)
+        unsigned int user_timeout;
+    };
+
+    struct ServerConfig {
+        // Number of event loop threads
+        unsigned int io_threads;
+        // Wait strategy of the acceptor
+        WaitProfile wait_profile;
+        // Busy-poll mode (see ConnectionConfig), the event loops never block either
+        unsigned int busy_poll;
+        // The acceptor only gets connections once they have sent something, or after this long (s, 0 disables it)
+        unsigned int defer_accept;
+        // Socket tuning of the connections
+        SocketProfile socket_profile;
+        // Frames read from & bytes sent to a connection per loop pass
+        unsigned int read_budget;
+        size_t write_budget;
+        // Messages at least this big are sent with MSG_ZEROCOPY (0 disables it)
+        size_t zerocopy;
+        // Same-host clients may send their messages through a shared memory ring
+        bool shm;
+        // Number of handler threads (0 disables the pipeline mode)
+        unsigned int handler_threads;
+        // Capacity of the handler command queue
+        size_t handler_queue_capacity;
+        // Channel message delivery, and the size of the channel logs (log delivery mode)
+        Delivery delivery;
+        size_t channel_log_size;
+        // Channel size past which broadcasts fan out in parallel (0 disables it), and the threads doing it when the
+        // pipeline mode is off
+        size_t fanout_threshold;
+        unsigned int fanout_threads;
+
+        // Connection idle timeout, keepalive ping interval & deadline and invite lifetime (0 disables each of them)
+        std::chrono::seconds idle_timeout;
+        std::chrono::seconds ping_interval;
+        std::chrono::seconds ping_timeout;
+        std::chrono::seconds invite_timeout;
+
+        // Kernel keepalive of accepted connections
+        KeepaliveConfig keepalive;
+
+        // Client outbound queue limits
+        OutboundConfig outbound;
+
+        // Client inbound rate limits, and the file they are (re)loaded from (empty if none)
+        RateLimitConfig rate_limits;
+        std::string rate_limits_file;
+
+        // Load shedding thresholds
+        OverloadConfig overload;
+
+        // Thread placement
+        AffinityConfig affinity;
+        // Connection placement over the event loops, and imbalance that triggers a rebalance (%)
+        Placement placement;
+        unsigned int rebalance_threshold;
     };
 
     ConnectionConfig parse_config(int argc, char *argv[]);
+
+    ServerConfig parse_server_config(int argc, char *argv[]);
+
+    // Load rate limits from a file of `name=value` lines (same names as the flags, `#` starts a comment). Only the
+    // listed limits are changed. Returns false if the file can't be read or is invalid, leaving the limits untouched.
+    bool load_rate_limits(const std::string &path, RateLimitConfig &limits);
 }
@@ -1,11 +1,17 @@
+#include<atomic>
 #include<iostream>
 #include<cstring>
 
 #include<fcntl.h>
 #include<unistd.h>
 #include<arpa/inet.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<linux/errqueue.h>
 #include<sys/socket.h>
+#include<sys/stat.h>
 #include<sys/types.h>
+#include<sys/un.h>
 
 #include "config.h"
 #include "error.h"
@@ -42,6 +48,99 @@ namespace network {
         return 0;
     }
 
+    int configure_tuning(int socket_fd, const config::SocketTuning &tuning) {
+        // Fixed buffers turn the kernel autotuning off, they are only set when asked for
+        if (tuning.send_buffer > 0 &&
+            setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &tuning.send_buffer, sizeof(tuning.send_buffer)) < 0) {
+            error::error("Failed to configure socket send buffer!");
+            return -1;
+        }
+
+        if (tuning.receive_buffer > 0 &&
+            setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &tuning.receive_buffer, sizeof(tuning.receive_buffer)) < 0) {
+            error::error("Failed to configure socket receive buffer!");
+            return -1;
+        }
+
+        // (0 goes back to the system wide limit, none by default)
+        if (setsockopt(socket_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &tuning.notsent_lowat,
+                       sizeof(tuning.notsent_lowat)) < 0) {
+            error::error("Failed to configure socket unsent limit!");
+            return -1;
+        }
+
+        int nodelay = tuning.nodelay;
+        if (setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0) {
+            error::error("Failed to configure Nagle's algorithm!");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    void set_cork(int connection_fd, bool cork) {
+        int enabled = cork;
+        setsockopt(connection_fd, IPPROTO_TCP, TCP_CORK, &enabled, sizeof(enabled));
+    }
+
+    int configure_defer_accept(int listener_fd, unsigned int seconds) {
+        int timeout = (int) seconds;
+        if (setsockopt(listener_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &timeout, sizeof(timeout)) < 0) {
+            error::error("Failed to configure deferred accept!");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    bool acked_within(int connection_fd, std::chrono::milliseconds window) {
+        struct tcp_info info{};
+        socklen_t length = sizeof(info);
+        if (getsockopt(connection_fd, IPPROTO_TCP, TCP_INFO, &info, &length) < 0) {
+            return false;
+        }
+
+        // Everything sent so far was acknowledged, or the peer is acknowledging a backlog of it
+        return info.tcpi_unacked == 0 || info.tcpi_last_ack_recv < window.count();
+    }
+
+    int configure_keepalive(int socket_fd, const config::KeepaliveConfig &keepalive) {
+        // Enable kernel keepalive probes, detecting dead peers even if the application never sends anything
+        if (keepalive.idle > 0) {
+            int enabled = 1;
+            int idle = (int) keepalive.idle;
+
+            if (setsockopt(socket_fd, SOL_SOCKET, SO_KEEPALIVE, &enabled, sizeof(enabled)) < 0 ||
+                setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0) {
+                error::error("Failed to configure socket keepalive!");
+                return -1;
+            }
+
+            int interval = (int) keepalive.interval;
+            if (interval > 0 && setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) < 0) {
+                error::error("Failed to configure socket keepalive interval!");
+                return -1;
+            }
+
+            int count = (int) keepalive.count;
+            if (count > 0 && setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) < 0) {
+                error::error("Failed to configure socket keepalive count!");
+                return -1;
+            }
+        }
+
+        // Drop the connection if sent data stays unacknowledged for too long (peer gone without a FIN/RST)
+        if (keepalive.user_timeout > 0) {
+            unsigned int user_timeout = keepalive.user_timeout;
+            if (setsockopt(socket_fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout)) < 0) {
+                error::error("Failed to configure socket user timeout!");
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
     // Create, configure and bind a listening socket following the given network config
     int listen(config::ConnectionConfig config) {
         // Create an IPv4 TCP socket
@@ -69,6 +168,14 @@ namespace network {
             return -1;
         }
 
+        // Accept data in the SYN of clients with a cookie (needs net.ipv4.tcp_fastopen to enable the server side)
+        if (config.fast_open) {
+            int queue = config::FAST_OPEN_QUEUE;
+            if (setsockopt(socket_fd, IPPROTO_TCP, TCP_FASTOPEN, &queue, sizeof(queue)) < 0) {
+                error::warning("Failed to enable TCP Fast Open on the listener!");
+            }
+        }
+
         // Listen on the created socket, with a limit of 63 pending connections
         if (::listen(socket_fd, 63) < 0) {
             error::error("Failed to listen on socket!");
@@ -80,12 +187,137 @@ namespace network {
             return -1;
         }
 
+        // Inherited by the accepted connections
+        configure_busy_poll(socket_fd, config.busy_poll);
+
         std::cout << "Server listening at " << config.host << ":" << config.port << std::endl;
         return socket_fd;
     }
 
+    // Build the address of a Unix domain socket, false if the path doesn't fit
+    static bool unix_address(const std::string &path, sockaddr_un &address) {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (path.size() >= sizeof(address.sun_path)) {
+            error::error("Unix socket path too long!");
+            return false;
+        }
+
+        std::memcpy(address.sun_path, path.data(), path.size());
+        return true;
+    }
+
+    // Is nobody listening on the Unix domain socket anymore (its server is gone without removing the file)
+    static bool stale_socket(const sockaddr_un &address) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (probe < 0) {
+            return false;
+        }
+
+        // A live listener accepts the connection, or has its backlog full (EAGAIN)
+        bool stale = ::connect(probe, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0 &&
+                     errno == ECONNREFUSED;
+        ::close(probe);
+
+        return stale;
+    }
+
+    int listen_unix(const std::string &path) {
+        struct sockaddr_un listen_address{};
+        if (!unix_address(path, listen_address)) {
+            return -1;
+        }
+
+        int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket_fd < 0) {
+            error::error("Failed to create socket!");
+            return -1;
+        }
+
+        if (configure_timeout(socket_fd) != 0) {
+            ::close(socket_fd);
+            return -1;
+        }
+
+        // The socket file of a previous run is left behind, replace it. Anything else at the path (another file, or
+        // the socket of a server still running) is kept, and there is no listener then.
+        struct stat status{};
+        if (lstat(path.c_str(), &status) == 0) {
+            if (!S_ISSOCK(status.st_mode)) {
+                error::error("Something other than a socket is at " + path + "!");
+                ::close(socket_fd);
+                return -1;
+            }
+
+            if (!stale_socket(listen_address)) {
+                error::error("The socket at " + path + " is in use!");
+                ::close(socket_fd);
+                return -1;
+            }
+
+            unlink(path.c_str());
+        }
+
+        if (bind(socket_fd, reinterpret_cast<const sockaddr *>(&listen_address), sizeof(listen_address)) < 0) {
+            error::error("Failed to bind socket!");
+            ::close(socket_fd);
+            return -1;
+        }
+
+        // Same backlog and mode as the TCP listener
+        if (::listen(socket_fd, 63) < 0 || configure_non_blocking(socket_fd) != 0) {
+            error::error("Failed to listen on socket!");
+            ::close(socket_fd);
+            return -1;
+        }
+
+        std::cout << "Server listening at " << path << std::endl;
+        return socket_fd;
+    }
+
+    // Send the first message (whatever is left of it) while the socket is still blocking
+    static int send_first_message(int socket_fd, const std::string &first_message, ssize_t sent) {
+        while ((size_t) sent < first_message.size()) {
+            ssize_t result = send(socket_fd, first_message.data() + sent, first_message.size() - sent, MSG_NOSIGNAL);
+            if (result < 0) {
+                return -1;
+            }
+            sent += result;
+        }
+
+        return 0;
+    }
+
+    // Connect to a server on the same host through its Unix domain socket
+    static int connect_unix(const std::string &path, const std::string &first_message) {
+        struct sockaddr_un server_address{};
+        if (!unix_address(path, server_address)) {
+            return -1;
+        }
+
+        int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket_fd < 0) {
+            return -1;
+        }
+
+        if (configure_timeout(socket_fd) != 0 ||
+            ::connect(socket_fd, reinterpret_cast<const sockaddr *>(&server_address), sizeof(server_address)) < 0 ||
+            send_first_message(socket_fd, first_message, 0) != 0 || configure_non_blocking(socket_fd) != 0) {
+            ::close(socket_fd);
+            return -1;
+        }
+
+        return socket_fd;
+    }
+
     // Connect to a server
-    int connect(config::ConnectionConfig config) {
+    int connect(config::ConnectionConfig config, const std::string &first_message) {
+        // Same-host server, no TCP at all (nor fast open or busy polling, which are TCP only)
+        if (!config.unix_paths.empty()) {
+            return connect_unix(config.unix_paths[0], first_message);
+        }
+
         // Create an IPv4 TCP socket
         int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
         if (socket_fd < 0) { // Check if a file descriptor was allocated
@@ -104,8 +336,31 @@ namespace network {
         server_address.sin_addr.s_addr = inet_addr(config.host.c_str()); // Connect to given address
         server_address.sin_port = htons(config.port); // Connect to given port
 
+        // Connect with the first message as SYN data (sent after the handshake if the kernel has no cookie yet)
+        ssize_t sent = -1;
+        if (config.fast_open && !first_message.empty()) {
+            sent = sendto(socket_fd, first_message.data(), first_message.size(), MSG_FASTOPEN | MSG_NOSIGNAL,
+                          reinterpret_cast<const sockaddr *>(&server_address), sizeof(server_address));
+
+            // Client side disabled by net.ipv4.tcp_fastopen, fall back to a regular connection
+            if (sent < 0 && errno != EOPNOTSUPP) {
+                return -1;
+            }
+            if (sent < 0) {
+                error::warning("TCP Fast Open is disabled (net.ipv4.tcp_fastopen), connecting normally");
+            }
+        }
+
         // Connect to the given client
-        if (::connect(socket_fd, reinterpret_cast<const sockaddr *>(&server_address), sizeof(server_address)) < 0) {
+        if (sent < 0) {
+            if (::connect(socket_fd, reinterpret_cast<const sockaddr *>(&server_address), sizeof(server_address)) < 0) {
+                return -1;
+            }
+            sent = 0;
+        }
+
+        // Whatever is left of the first message (all of it without fast open)
+        if (send_first_message(socket_fd, first_message, sent) != 0) {
             return -1;
         }
 
@@ -114,10 +369,56 @@ namespace network {
             return -1;
         }
 
+        configure_busy_poll(socket_fd, config.busy_poll);
+
         return socket_fd;
     }
 
 
+    void configure_busy_poll(int socket_fd, unsigned int busy_poll) {
+        if (busy_poll == 0) {
+            return;
+        }
+
+        // Only warn once, every connection would fail the same way
+        static std::atomic<bool> warned = false;
+
+        int enabled = 1;
+        if (setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled)) < 0 && !warned.exchange(true)) {
+            error::warning("Failed to disable Nagle's algorithm!");
+        }
+
+        // Above net.core.busy_poll, CAP_NET_ADMIN is needed
+        int timeout = (int) busy_poll;
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &timeout, sizeof(timeout)) < 0 && !warned.exchange(true)) {
+            error::warning("Failed to configure socket busy polling (needs CAP_NET_ADMIN)!");
+        }
+
+#ifdef SO_PREFER_BUSY_POLL
+        // Keep the device interrupts off while the application polls (Linux 5.11+)
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &enabled, sizeof(enabled)) < 0 &&
+            !warned.exchange(true)) {
+            error::warning("Failed to configure preferred busy polling!");
+        }
+#endif
+    }
+
+    bool configure_zerocopy(int socket_fd) {
+        // Only warn once, every connection would fail the same way
+        static std::atomic<bool> warned = false;
+
+        // Linux 4.14+
+        int enabled = 1;
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY, &enabled, sizeof(enabled)) < 0) {
+            if (!warned.exchange(true)) {
+                error::warning("Zero-copy sends are not supported, sending normally!");
+            }
+            return false;
+        }
+
+        return true;
+    }
+
     // Accept an incoming connection to the network
     Connection accept_conn(int listener_fd) {
 
@@ -126,8 +427,10 @@ namespace network {
         std::memset(&new_conn, 0, sizeof(struct Connection));
         unsigned int addr_len = sizeof(Connection::client_address);
 
-        // Accept next available connection (blocking)
-        int conn_fd = ::accept(listener_fd, reinterpret_cast<sockaddr *>(&new_conn.client_address), &addr_len);
+        // Accept next available connection, non-blocking from the start (the rest of its options come from the
+        // listener)
+        int conn_fd = ::accept4(listener_fd, reinterpret_cast<sockaddr *>(&new_conn.client_address), &addr_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (conn_fd < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 new_conn.socket_fd = -2;
@@ -139,12 +442,6 @@ namespace network {
             return new_conn;
         }
 
-        // Configure socket timeout & blocking mode
-        if (configure_timeout(conn_fd) != 0 || configure_non_blocking(conn_fd) != 0) {
-            new_conn.socket_fd = -1;
-            return new_conn;
-        }
-
         // Update client connection file descriptor
         new_conn.socket_fd = conn_fd;
         return new_conn;
@@ -166,6 +463,71 @@ namespace network {
         return (int) received;
     }
 
+    int read_message_fds(int connection_fd, char *buffer, std::vector<int> &fds) {
+        iovec slice = {buffer, config::MAX_MESSAGE_SIZE};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * config::MAX_PASSED_FDS)];
+
+        msghdr header{};
+        header.msg_iov = &slice;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+
+        ssize_t received = recvmsg(connection_fd, &header, MSG_CMSG_CLOEXEC);
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return -2;
+            }
+
+            error::error("Receive error!");
+            return -1;
+        }
+
+        // (fds that didn't fit are closed by the kernel, MSG_CTRUNC)
+        for (cmsghdr *message = CMSG_FIRSTHDR(&header); message != nullptr; message = CMSG_NXTHDR(&header, message)) {
+            if (message->cmsg_level != SOL_SOCKET || message->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+
+            size_t count = (message->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; i++) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(message) + i * sizeof(int), sizeof(int));
+                fds.push_back(fd);
+            }
+        }
+
+        return (int) received;
+    }
+
+    int send_fds(int connection_fd, const std::string &message, const std::vector<int> &fds) {
+        iovec slice = {const_cast<char *>(message.data()), message.size()};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * config::MAX_PASSED_FDS)]{};
+
+        if (fds.empty() || fds.size() > config::MAX_PASSED_FDS) {
+            return -1;
+        }
+
+        msghdr header{};
+        header.msg_iov = &slice;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+        cmsghdr *rights = CMSG_FIRSTHDR(&header);
+        rights->cmsg_level = SOL_SOCKET;
+        rights->cmsg_type = SCM_RIGHTS;
+        rights->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(rights), fds.data(), sizeof(int) * fds.size());
+
+        if (sendmsg(connection_fd, &header, MSG_NOSIGNAL) != (ssize_t) message.size()) {
+            error::error("Failed to pass fds!");
+            return -1;
+        }
+
+        return 0;
+    }
+
     // Send message to the target connection
     int send_message(int connection_fd, char *buffer, int length) {
         ssize_t sent = send(connection_fd, buffer, length, 0);
@@ -182,6 +544,69 @@ namespace network {
         return (int) sent;
     }
 
+    // Send the slices of a message to the target connection in one go
+    int send_gather(int connection_fd, struct iovec *slices, int count, int flags) {
+        struct msghdr header = {};
+        header.msg_iov = slices;
+        header.msg_iovlen = count;
+
+        // A peer gone while its messages are still being flushed is a send error, not a signal killing the server
+        ssize_t sent = sendmsg(connection_fd, &header, flags | MSG_NOSIGNAL);
+
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return -2;
+            }
+
+            // Out of pinned memory for the socket (optmem), the completions must be read first
+            if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                return -3;
+            }
+
+            error::error("Send error!");
+            return -1;
+        }
+
+        return (int) sent;
+    }
+
+    int zerocopy_completion(int connection_fd, uint32_t &first, uint32_t &last, bool &copied) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+
+        struct msghdr header = {};
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+
+        while (true) {
+            if (recvmsg(connection_fd, &header, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 0;
+                }
+
+                error::error("Failed to read zero-copy completions!");
+                return -1;
+            }
+
+            struct cmsghdr *message = CMSG_FIRSTHDR(&header);
+            if (message == nullptr) {
+                return 0;
+            }
+
+            auto *notification = reinterpret_cast<struct sock_extended_err *>(CMSG_DATA(message));
+
+            // Anything else on the error queue is of no interest here
+            if (notification->ee_errno != 0 || notification->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                header.msg_controllen = sizeof(control);
+                continue;
+            }
+
+            first = notification->ee_info;
+            last = notification->ee_data;
+            copied = notification->ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+            return 1;
+        }
+    }
+
     // Close connection
     int close(int connection_fd) {
         int status = ::close(connection_fd);
@@ -194,6 +619,11 @@ namespace network {
     }
 
     std::string address_repr(const sockaddr_in &addr) {
+        // Unix domain socket peers have no address (accept only fills the family in)
+        if (addr.sin_family == AF_UNIX) {
+            return "local";
+        }
+
         char buffer[32];
         if (inet_ntop(AF_INET, &addr.sin_addr, buffer, 32) == nullptr) {
             return "?";
@@ -2,12 +2,16 @@
 
 #include<arpa/inet.h>
 #include<sys/socket.h>
+#include<sys/uio.h>
+
+#include<vector>
 
 #include "config.h"
 
 
 namespace network {
     typedef struct Connection {
+        // (only the family, AF_UNIX, for Unix domain socket peers)
         struct sockaddr_in client_address;
         int socket_fd;
     } Connection;
@@ -15,20 +19,68 @@ namespace network {
     // Create, configure and bind a listening socket following the given network config
     int listen(config::ConnectionConfig config);
 
-    // Connect to a server
-    int connect(config::ConnectionConfig config);
+    // Create a listening Unix domain socket at the path, for clients on the same host. A socket file left behind by a
+    // previous run is replaced, as long as nobody listens on it anymore.
+    int listen_unix(const std::string &path);
+
+    // Connect to a server (through the first Unix domain socket of the config, if any), sending the first message right
+    // away (empty for none). With fast open, the message rides in the SYN once the kernel has a cookie from the server
+    // (the first connection only fetches it).
+    int connect(config::ConnectionConfig config, const std::string &first_message = "");
 
-    // Accept an incoming connection to the network
+    // Accept an incoming connection to the network, already non-blocking. Socket options are set on the listener
+    // instead, accepted connections inherit them (timeouts, keepalive, busy polling, zero-copy).
     Connection accept_conn(int listener_fd);
 
+    // Apply the socket options of a tuning profile (on a listener, to every connection accepted on it)
+    int configure_tuning(int socket_fd, const config::SocketTuning &tuning);
+
+    // Cork or uncork the connection (TCP_CORK), partial segments are held back while it is corked
+    void set_cork(int connection_fd, bool cork);
+
+    // Have the listener hold connections back until they send something, or for `seconds` at most (TCP_DEFER_ACCEPT)
+    int configure_defer_accept(int listener_fd, unsigned int seconds);
+
+    // Is the peer TCP acknowledging what is sent over the connection: everything sent is acknowledged, or something
+    // was within the last `window` (TCP_INFO). False otherwise, or if the connection has no TCP state (Unix domain
+    // sockets).
+    bool acked_within(int connection_fd, std::chrono::milliseconds window);
+
+    // Kernel keepalive of the socket (zeroed fields keep the system defaults)
+    int configure_keepalive(int socket_fd, const config::KeepaliveConfig &keepalive);
+
+    // Low latency socket options of the busy-poll mode: busy poll the device queue for this long (us) on reads and
+    // disable Nagle. Best effort, the connection works (slower) without them.
+    void configure_busy_poll(int socket_fd, unsigned int busy_poll);
+
+    // Let sends to the socket (or the connections accepted on it) use MSG_ZEROCOPY, returns false if the kernel doesn't
+    // support it (warning once)
+    bool configure_zerocopy(int socket_fd);
+
     // Read message from the target connection
     int read_message(int connection_fd, char *buffer);
 
+    // Read message from a Unix domain socket connection, appending the fds passed along with it (SCM_RIGHTS) to fds
+    int read_message_fds(int connection_fd, char *buffer, std::vector<int> &fds);
+
+    // Send message to a Unix domain socket connection along with fds (SCM_RIGHTS). Returns 0 once it is sent, -1
+    // otherwise (a full socket buffer included).
+    int send_fds(int connection_fd, const std::string &message, const std::vector<int> &fds);
+
     // Send message to the target connection
     int send_message(int connection_fd, char *buffer, int length);
 
+    // Send the slices of a message to the target connection in one go (same results as send_message). With
+    // MSG_ZEROCOPY in the flags, -3 means the kernel can't take a zero-copy send right now (send it normally instead).
+    int send_gather(int connection_fd, struct iovec *slices, int count, int flags = 0);
+
+    // Next zero-copy completion of the connection: the range of sends [first, last] whose buffers the kernel released,
+    // and whether it had to copy them after all. Returns 1 if there was one, 0 if none is waiting and -1 on errors.
+    int zerocopy_completion(int connection_fd, uint32_t &first, uint32_t &last, bool &copied);
+
     // Close connection
     int close(int connection_fd);
 
+    // Printable address of a peer ("local" for Unix domain socket peers)
     std::string address_repr(const sockaddr_in &addr);
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include<cstring>
+#include<string>
+#include<string_view>
+
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/eventfd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include "error.h"
+#include "shmring.h"
+
+namespace shmring {
+    static const uint32_t MAGIC = 0x72696e67;
+    static const uint32_t PADDING = 0xffffffff;
+
+    // Frames start on a page boundary after the header
+    static const size_t HEADER_SIZE = 4096;
+
+    // Shrinking the memfd under the consumer would fault it (SIGBUS), so it must not be possible
+    static const int REQUIRED_SEALS = F_SEAL_SHRINK | F_SEAL_SEAL;
+
+    static size_t record_size(size_t length) {
+        return (sizeof(uint32_t) + length + 7) & ~(size_t) 7;
+    }
+
+    static bool map(Ring &ring, size_t size) {
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring.memfd, 0);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+
+        ring.header = static_cast<Header *>(memory);
+        ring.data = static_cast<char *>(memory) + HEADER_SIZE;
+        ring.mapped = size;
+        return true;
+    }
+
+    // The consumer reads the eventfd from its event loop, whatever the producer passed must really be one
+    static bool is_eventfd(int fd) {
+        std::string path = "/proc/self/fd/" + std::to_string(fd);
+        char target[64];
+
+        ssize_t length = readlink(path.c_str(), target, sizeof(target));
+        return length > 0 && std::string_view(target, length) == "anon_inode:[eventfd]";
+    }
+
+    bool create(Ring &ring, uint32_t capacity) {
+        size_t size = HEADER_SIZE + capacity;
+
+        ring.memfd = memfd_create("chat-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        ring.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ring.space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ring.memfd < 0 || ring.event_fd < 0 || ring.space_fd < 0 || ftruncate(ring.memfd, (off_t) size) != 0 ||
+            fcntl(ring.memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0 || !map(ring, size)) {
+            error::error("Failed to create the shared memory ring!");
+            release(ring);
+            return false;
+        }
+
+        // (a fresh memfd is zeroed, positions and flags included)
+        ring.header->magic = MAGIC;
+        ring.header->capacity = capacity;
+        ring.capacity = capacity;
+        return true;
+    }
+
+    bool attach(Ring &ring, int memfd, int event_fd, int space_fd) {
+        ring.memfd = memfd;
+        ring.event_fd = event_fd;
+        ring.space_fd = space_fd;
+
+        // Sealed first, so the size read afterwards holds for as long as the ring is mapped
+        int seals = fcntl(memfd, F_GET_SEALS);
+        if (seals < 0 || (seals & REQUIRED_SEALS) != REQUIRED_SEALS) {
+            release(ring);
+            return false;
+        }
+
+        struct stat status{};
+        if (fstat(memfd, &status) != 0 || (size_t) status.st_size <= HEADER_SIZE) {
+            release(ring);
+            return false;
+        }
+
+        // Using the eventfds must never block the consumer (the flag is on the producer's side as well)
+        for (int fd: {event_fd, space_fd}) {
+            int flags = fcntl(fd, F_GETFL);
+            if (!is_eventfd(fd) || flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+                release(ring);
+                return false;
+            }
+        }
+
+        if (!map(ring, status.st_size)) {
+            release(ring);
+            return false;
+        }
+
+        // The capacity is read once, it must be a power of two that fits the memfd
+        uint32_t capacity = ring.header->capacity;
+        if (ring.header->magic != MAGIC || capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+            capacity > ring.mapped - HEADER_SIZE) {
+            release(ring);
+            return false;
+        }
+
+        ring.capacity = capacity;
+        ring.position = ring.header->tail.load(std::memory_order_relaxed);
+        return true;
+    }
+
+    void release(Ring &ring) {
+        if (ring.header != nullptr) {
+            munmap(ring.header, ring.mapped);
+        }
+        if (ring.memfd >= 0) {
+            close(ring.memfd);
+        }
+        if (ring.event_fd >= 0) {
+            close(ring.event_fd);
+        }
+        if (ring.space_fd >= 0) {
+            close(ring.space_fd);
+        }
+
+        ring = Ring{};
+    }
+
+    bool write(Ring &ring, const char *message, size_t length) {
+        size_t record = record_size(length);
+        size_t offset = ring.position & (ring.capacity - 1);
+        size_t to_end = ring.capacity - offset;
+
+        // Room for the frame, and for the padding in front of it if it has to start over at the beginning
+        size_t needed = record > to_end ? record + to_end : record;
+        uint64_t tail = ring.header->tail.load(std::memory_order_acquire);
+        if (ring.position + needed - tail > ring.capacity) {
+            return false;
+        }
+
+        if (record > to_end) {
+            std::memcpy(ring.data + offset, &PADDING, sizeof(PADDING));
+            ring.position += to_end;
+            offset = 0;
+        }
+
+        auto frame_length = (uint32_t) length;
+        std::memcpy(ring.data + offset, &frame_length, sizeof(frame_length));
+        std::memcpy(ring.data + offset + sizeof(frame_length), message, length);
+        ring.position += record;
+
+        // Publishing the head and checking the flag are both sequentially consistent, pairing with sleep(): either
+        // the consumer sees the frame, or we see it waiting
+        ring.header->head.store(ring.position);
+        if (ring.header->waiting.load() && ring.header->waiting.exchange(0)) {
+            eventfd_write(ring.event_fd, 1);
+        }
+
+        return true;
+    }
+
+    // The consumer moved the tail on, signal the producer if it is waiting for room. The fences pair with want_space():
+    // either the producer sees the new tail, or we see it waiting.
+    static void freed(Ring &ring, uint64_t tail) {
+        if (ring.position == tail) {
+            return;
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring.header->producer_waiting.load() && ring.header->producer_waiting.exchange(0)) {
+            eventfd_write(ring.space_fd, 1);
+        }
+    }
+
+    static int read_frame(Ring &ring, char *buffer, size_t max) {
+        while (true) {
+            uint64_t head = ring.header->head.load(std::memory_order_acquire);
+            if (head == ring.position) {
+                return -2;
+            }
+
+            // Whatever the producer wrote is checked before being used, it never gets past the mapping
+            size_t available = head - ring.position;
+            size_t offset = ring.position & (ring.capacity - 1);
+            size_t to_end = ring.capacity - offset;
+            if (available > ring.capacity || available < sizeof(uint32_t)) {
+                return -1;
+            }
+
+            uint32_t length;
+            std::memcpy(&length, ring.data + offset, sizeof(length));
+
+            if (length == PADDING) {
+                if (to_end > available) {
+                    return -1;
+                }
+                ring.position += to_end;
+                ring.header->tail.store(ring.position, std::memory_order_release);
+                continue;
+            }
+
+            size_t record = record_size(length);
+            if (length > max || record > to_end || record > available) {
+                return -1;
+            }
+
+            // Copied out, the producer could still change it in place
+            std::memcpy(buffer, ring.data + offset + sizeof(length), length);
+            ring.position += record;
+            ring.header->tail.store(ring.position, std::memory_order_release);
+
+            // (empty frames carry nothing, and 0 means a closed connection to the readers)
+            if (length == 0) {
+                continue;
+            }
+
+            return (int) length;
+        }
+    }
+
+    int read(Ring &ring, char *buffer, size_t max) {
+        uint64_t tail = ring.position;
+        int result = read_frame(ring, buffer, max);
+        freed(ring, tail);
+
+        return result;
+    }
+
+    bool sleep(Ring &ring) {
+        // Signals of frames already read would wake the consumer up for nothing
+        eventfd_t value;
+        eventfd_read(ring.event_fd, &value);
+
+        ring.header->waiting.store(1);
+        if (ring.header->head.load() != ring.position) {
+            ring.header->waiting.store(0);
+            return false;
+        }
+
+        return true;
+    }
+
+    void want_space(Ring &ring) {
+        // Signals of room already seen would wake the producer up for nothing
+        eventfd_t value;
+        eventfd_read(ring.space_fd, &value);
+
+        ring.header->producer_waiting.store(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
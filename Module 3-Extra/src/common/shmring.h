@@ -0,0 +1,62 @@
+#pragma once
+
+#include<atomic>
+#include<cstddef>
+#include<cstdint>
+
+namespace shmring {
+    // Shared part of the ring, at the start of the memfd (the frames follow it, at HEADER_SIZE). Frames are a 32-bit
+    // length followed by the bytes, padded to 8 bytes. A frame never wraps, the end of the ring is skipped with a
+    // padding record instead. Positions only grow, their offset in the ring is taken modulo the capacity.
+    struct Header {
+        uint32_t magic;
+        uint32_t capacity;
+        // Written by the producer (client) & consumer (server), on their own cache lines
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+        // Set by the consumer before it waits, the producer only signals the eventfd when it is set
+        alignas(64) std::atomic<uint32_t> waiting;
+        // Set by the producer before it waits for room, the consumer only signals the space eventfd when it is set
+        alignas(64) std::atomic<uint32_t> producer_waiting;
+    };
+
+    // One side of a ring. The positions and capacity the side relies on are private copies, the other process can't
+    // make it read outside of the mapping.
+    struct Ring {
+        Header *header = nullptr;
+        char *data = nullptr;
+        uint32_t capacity = 0;
+        size_t mapped = 0;
+        // Head (producer) or tail (consumer)
+        uint64_t position = 0;
+        int memfd = -1;
+        // New frames (signalled by the producer) and room freed (signalled by the consumer)
+        int event_fd = -1;
+        int space_fd = -1;
+    };
+
+    // Producer side: a sealed memfd of the given capacity (power of two) and its eventfds, false on errors
+    bool create(Ring &ring, uint32_t capacity);
+
+    // Consumer side: map a ring received from the producer (taking over its fds), false if it isn't a valid ring (a
+    // sealed memfd and two eventfds)
+    bool attach(Ring &ring, int memfd, int event_fd, int space_fd);
+
+    // Unmap the ring and close its fds
+    void release(Ring &ring);
+
+    // Queue a frame, signalling the consumer if it is waiting. Returns false if the ring is full (nothing is queued).
+    bool write(Ring &ring, const char *message, size_t length);
+
+    // Copy the next frame into the buffer (at most max bytes). Returns its length, -2 if the ring is empty or -1 if
+    // the producer corrupted it.
+    int read(Ring &ring, char *buffer, size_t max);
+
+    // Consumer is about to wait for the eventfd: ask the producer for a signal. Returns false if a frame came in
+    // meanwhile (read it instead of waiting).
+    bool sleep(Ring &ring);
+
+    // Producer found the ring full and is about to wait for the space eventfd: ask the consumer for a signal once it
+    // read on. The write must be tried again before waiting (the room may have been freed meanwhile).
+    void want_space(Ring &ring);
+}
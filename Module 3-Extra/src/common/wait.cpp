@@ -0,0 +1,127 @@
+#include<climits>
+#include<thread>
+
+#include<poll.h>
+#include<sys/eventfd.h>
+#include<unistd.h>
+
+#include "error.h"
+#include "wait.h"
+
+namespace wait {
+    // Spin iterations of a single spinning round
+    static const int SPIN_ITERATIONS = 64;
+
+    // Tell the CPU we are busy-waiting (saves power and frees the core for its sibling hyper-thread)
+    static inline void cpu_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    Strategy strategy_for(config::WaitProfile profile) {
+        switch (profile) {
+            case config::WaitProfile::LATENCY:
+                // Stay on the CPU for a while, and never sleep for long
+                return Strategy{2000, 200, std::chrono::microseconds(20), std::chrono::microseconds(1000)};
+
+            case config::WaitProfile::BUSY:
+                // Spin forever, never giving the CPU up
+                return Strategy{UINT_MAX, 0, std::chrono::microseconds(0), std::chrono::microseconds(0)};
+
+            case config::WaitProfile::CPU:
+            default:
+                // Give up the CPU quickly, and park for long once idle
+                return Strategy{20, 10, std::chrono::microseconds(100), std::chrono::microseconds(50000)};
+        }
+    }
+
+    Waiter waiter_for(config::WaitProfile profile, bool wakeable) {
+        Strategy strategy = strategy_for(profile);
+
+        // Spinning on the only CPU just delays whoever we are waiting for, yield instead
+        if (std::thread::hardware_concurrency() <= 1) {
+            strategy.yields += strategy.spins;
+            strategy.spins = 0;
+        }
+        Waiter waiter = {strategy, 0, strategy.min_sleep, -1};
+
+        if (wakeable) {
+            waiter.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            if (waiter.wake_fd < 0) {
+                error::warning("Failed to create a wake-up fd, waits won't be cut short");
+            }
+        }
+
+        return waiter;
+    }
+
+    void idle(Waiter &waiter, int fd, int other_fd) {
+        const Strategy &strategy = waiter.strategy;
+
+        if (waiter.rounds < strategy.spins) {
+            waiter.rounds++;
+            for (int i = 0; i < SPIN_ITERATIONS; i++) {
+                cpu_pause();
+            }
+            return;
+        }
+
+        if (waiter.rounds < strategy.spins + strategy.yields) {
+            waiter.rounds++;
+            std::this_thread::yield();
+            return;
+        }
+
+        // Sleep until an fd is readable, a wake-up or the backoff timeout
+        pollfd fds[3] = {{waiter.wake_fd, POLLIN, 0}, {fd, POLLIN, 0}, {other_fd, POLLIN, 0}};
+        timespec timeout = {
+                .tv_sec = (time_t) (waiter.sleep.count() / 1000000),
+                .tv_nsec = (long) (waiter.sleep.count() % 1000000) * 1000,
+        };
+
+        if (fd >= 0 || other_fd >= 0 || waiter.wake_fd >= 0) {
+            ppoll(fds, 3, &timeout, nullptr);
+        } else {
+            std::this_thread::sleep_for(waiter.sleep);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t value;
+            while (read(waiter.wake_fd, &value, sizeof(value)) > 0) {}
+        }
+
+        waiter.sleep = std::min(waiter.sleep * 2, strategy.max_sleep);
+    }
+
+    bool writable(Waiter &waiter, int fd, std::chrono::milliseconds timeout) {
+        pollfd fds[2] = {{fd, POLLOUT, 0}, {waiter.wake_fd, POLLIN, 0}};
+        int ready = poll(fds, 2, (int) timeout.count());
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            while (read(waiter.wake_fd, &value, sizeof(value)) > 0) {}
+        }
+
+        return ready != 0;
+    }
+
+    void reset(Waiter &waiter) {
+        waiter.rounds = 0;
+        waiter.sleep = waiter.strategy.min_sleep;
+    }
+
+    void wake(const Waiter &waiter) {
+        if (waiter.wake_fd < 0) {
+            return;
+        }
+
+        uint64_t one = 1;
+        if (write(waiter.wake_fd, &one, sizeof(one)) < 0) {
+            error::warning("Failed to wake a waiter!");
+        }
+    }
+}
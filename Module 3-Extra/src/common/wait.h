@@ -0,0 +1,44 @@
+#pragma once
+
+#include<chrono>
+
+#include "config.h"
+
+namespace wait {
+    // Escalating wait of a polling thread: spin (with a CPU pause hint), then yield the CPU, then sleep with an
+    // exponential backoff up to a long park. Sleeps end early once the watched fd is readable or the waiter is woken
+    // up, so backing off doesn't add latency to the next event. Any progress resets it to the spinning stage.
+    struct Strategy {
+        // Idle rounds spent spinning, then yielding
+        unsigned int spins;
+        unsigned int yields;
+        // Backoff sleeps, from the first one up to the park
+        std::chrono::microseconds min_sleep;
+        std::chrono::microseconds max_sleep;
+    };
+
+    struct Waiter {
+        Strategy strategy;
+        unsigned int rounds;
+        std::chrono::microseconds sleep;
+        // eventfd used by other threads to cut a sleep short (-1 if the waiter can't be woken up)
+        int wake_fd;
+    };
+
+    Strategy strategy_for(config::WaitProfile profile);
+
+    // Build a waiter, optionally one other threads can wake up
+    Waiter waiter_for(config::WaitProfile profile, bool wakeable);
+
+    // Nothing to do, wait a little (longer each time) or until one of the fds is readable (-1 to watch none)
+    void idle(Waiter &waiter, int fd, int other_fd = -1);
+
+    // Wait until the fd is writable, the waiter is woken up or the timeout. False if it timed out.
+    bool writable(Waiter &waiter, int fd, std::chrono::milliseconds timeout);
+
+    // Something was done, go back to spinning
+    void reset(Waiter &waiter);
+
+    // Cut the current (or next) sleep of the waiter short, safe from any thread
+    void wake(const Waiter &waiter);
+}
@@ -0,0 +1,39 @@
+#include "channellog.h"
+
+namespace worker::server {
+    void log_init(ChannelLog *log, size_t capacity) {
+        log->slots.resize(capacity);
+        log->next = 0;
+    }
+
+    void log_append(ChannelLog *log, const Frame &message) {
+        auto guard = std::lock_guard<std::mutex>(log->mutex);
+
+        // Overwriting the oldest message, whoever still had to read it lagged
+        log->slots[log->next % log->slots.size()] = message;
+        log->next++;
+    }
+
+    uint64_t log_head(ChannelLog *log) {
+        auto guard = std::lock_guard<std::mutex>(log->mutex);
+        return log->next;
+    }
+
+    Frame log_read(ChannelLog *log, uint64_t &cursor, uint64_t &skipped) {
+        auto guard = std::lock_guard<std::mutex>(log->mutex);
+        uint64_t capacity = log->slots.size();
+
+        skipped = 0;
+        if (log->next > capacity && cursor < log->next - capacity) {
+            skipped = log->next - capacity - cursor;
+            cursor = log->next - capacity;
+            return {};
+        }
+
+        if (cursor >= log->next) {
+            return {};
+        }
+
+        return log->slots[cursor++ % capacity];
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include<cstdint>
+#include<memory>
+#include<mutex>
+#include<vector>
+
+#include "outbound.h"
+
+namespace worker::server {
+    // Append-only ring of the latest messages of a channel (log delivery mode). Members don't get a copy of each
+    // message, they only keep a cursor (sequence number) into the ring and their writers read it at their own pace.
+    // Messages older than the ring capacity are gone, members still behind them have lagged.
+    struct ChannelLog {
+        std::mutex mutex;
+
+        // Message with sequence number s sits at s % capacity
+        std::vector<Frame> slots;
+        // Sequence number of the next message
+        uint64_t next = 0;
+    };
+
+    void log_init(ChannelLog *log, size_t capacity);
+
+    void log_append(ChannelLog *log, const Frame &message);
+
+    // Sequence number a new reader starts from (only the messages appended from now on)
+    uint64_t log_head(ChannelLog *log);
+
+    // Message at the cursor, advancing it (an empty frame once the reader is caught up). A cursor that fell off the ring
+    // is moved to the oldest message still there instead, nothing is read (an empty frame) and `skipped` tells how many
+    // were lost.
+    Frame log_read(ChannelLog *log, uint64_t &cursor, uint64_t &skipped);
+}
@@ -0,0 +1,835 @@
+#include<cerrno>
+#include<iostream>
+#include<latch>
+#include<thread>
+#include<utility>
+
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+
+#include "../common/affinity.h"
+#include "../common/error.h"
+#include "../common/network.h"
+
+#include "worker.h"
+#include "loop.h"
+
+namespace worker::server {
+    // Loop running on the current thread
+    static thread_local EventLoop *local_loop = nullptr;
+
+    // Resume a suspended coroutine, clearing its slot first (it may suspend itself on the same slot again)
+    static void resume(std::coroutine_handle<> &slot) {
+        if (slot) {
+            auto handle = std::exchange(slot, nullptr);
+            handle.resume();
+        }
+    }
+
+    EventLoop *current_loop() {
+        return local_loop;
+    }
+
+    // Queue the work behind everything posted to the loop so far, from any thread (the loop itself included)
+    static void post_fifo(EventLoop *loop, std::function<void()> &&work) {
+        bool notify;
+
+        {
+            auto guard = std::lock_guard<std::mutex>(loop->posted_mutex);
+
+            // Loop is gone (server shutting down), nothing will ever run it
+            if (loop->stopped) {
+                return;
+            }
+
+            // The loop only needs a wake-up for the first pending work, it drains everything at once
+            notify = loop->posted.empty();
+            loop->posted.push_back(std::move(work));
+        }
+
+        if (notify) {
+            uint64_t one = 1;
+            if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+                error::error("Failed to wake event loop!");
+            }
+        }
+    }
+
+    void post(EventLoop *loop, std::function<void()> &&work) {
+        // Work from the loop thread itself doesn't need any synchronization
+        if (local_loop == loop) {
+            loop->ready.push_back(std::move(work));
+            return;
+        }
+
+        post_fifo(loop, std::move(work));
+    }
+
+    ////////////
+    // Timers //
+    ////////////
+
+    static uint64_t to_ticks(std::chrono::milliseconds delay) {
+        // Round up, a timer must never fire early
+        return (delay.count() + config::TIMER_TICK.count() - 1) / config::TIMER_TICK.count();
+    }
+
+    static uint64_t current_tick(EventLoop *loop) {
+        auto elapsed = std::chrono::steady_clock::now() - loop->started;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed) / config::TIMER_TICK;
+    }
+
+    void post_after(EventLoop *loop, std::chrono::milliseconds delay, std::function<void()> &&work) {
+        post(loop, [loop, delay, work = std::move(work)]() mutable {
+            auto *timer = new Timer();
+            timer->owned = true;
+            timer->callback = std::move(work);
+            timer_schedule(&loop->wheel, timer, to_ticks(delay));
+        });
+    }
+
+    void loop_timer(EventLoop *loop, Timer *timer, std::chrono::milliseconds delay) {
+        timer_schedule(&loop->wheel, timer, to_ticks(delay));
+    }
+
+    uint64_t now_ms() {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+    }
+
+    /////////////////
+    // Loop Thread //
+    /////////////////
+
+    static void run_posted(EventLoop *loop) {
+        std::vector<std::function<void()> > posted;
+
+        {
+            auto guard = std::lock_guard<std::mutex>(loop->posted_mutex);
+            posted.swap(loop->posted);
+        }
+
+        for (auto &work: posted) {
+            work();
+        }
+    }
+
+    static void run_ready(EventLoop *loop) {
+        // Only run what is ready right now, work scheduled meanwhile waits for the next iteration (after polling)
+        size_t count = loop->ready.size();
+
+        for (size_t i = 0; i < count; i++) {
+            std::function<void()> work = std::move(loop->ready.front());
+            loop->ready.pop_front();
+            work();
+        }
+    }
+
+    static void run(EventLoop *loop, State *state) {
+        local_loop = loop;
+
+        epoll_event events[config::LOOP_MAX_EVENTS];
+        bool closing = false;
+
+        bool single_cpu = std::thread::hardware_concurrency() <= 1;
+
+        // Start of the current pass (everything done between two polls)
+        auto pass_started = std::chrono::steady_clock::now();
+
+        while (true) {
+            run_posted(loop);
+            run_ready(loop);
+            wheel_advance(&loop->wheel, current_tick(loop));
+
+            // On a kill, wake every session so they can notice it and close their connections
+            if (state->kill && !closing) {
+                closing = true;
+
+                for (const auto &client_ptr: loop->clients) {
+                    wake_reader(client_ptr);
+                    wake_writer(client_ptr);
+                }
+            }
+
+            if (closing && loop->clients.empty() && loop->ready.empty()) {
+                break;
+            }
+
+            // Don't block if there is work waiting (or ever in busy-poll mode), nor past the next tick if there are
+            // timers. The kill flag is set by a signal handler, so the wait is also periodically interrupted to check
+            // it.
+            int timeout = (int) config::LOOP_WAIT_INTERVAL.count();
+            if (!loop->ready.empty() || state->config.busy_poll > 0) {
+                timeout = 0;
+            } else if (loop->wheel.armed > 0) {
+                timeout = (int) config::TIMER_TICK.count();
+            }
+
+            auto pass = std::chrono::steady_clock::now() - pass_started;
+            uint64_t pass_us = std::chrono::duration_cast<std::chrono::microseconds>(pass).count();
+            if (pass_us > loop->max_pass) {
+                loop->max_pass = pass_us;
+            }
+            loop->busy_us.fetch_add(pass_us, std::memory_order_relaxed);
+
+            int count = epoll_wait(loop->epoll_fd, events, config::LOOP_MAX_EVENTS, timeout);
+            pass_started = std::chrono::steady_clock::now();
+
+            // Busy polling on the only CPU would starve everything else (starting with whoever we are polling for)
+            if (count == 0 && timeout == 0 && state->config.busy_poll > 0 && single_cpu) {
+                std::this_thread::yield();
+            }
+
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                error::error("Event loop polling failed!");
+                state->kill = true;
+                continue;
+            }
+
+            for (int i = 0; i < count; i++) {
+                // Wake-up from another thread, posted work is run on the next iteration
+                if (events[i].data.ptr == nullptr) {
+                    uint64_t value;
+                    while (read(loop->wake_fd, &value, sizeof(value)) > 0) {}
+                    continue;
+                }
+
+                // Sessions are closed through posted work, so the client is still alive here
+                auto *client = static_cast<Client *>(events[i].data.ptr);
+                uint32_t flags = events[i].events;
+
+                if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    resume(client->io.reader);
+                }
+
+                if (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                    resume(client->io.writer);
+                }
+            }
+        }
+
+        {
+            auto guard = std::lock_guard<std::mutex>(loop->posted_mutex);
+            loop->stopped = true;
+            loop->posted.clear();
+        }
+
+        wheel_clear(&loop->wheel);
+
+        local_loop = nullptr;
+    }
+
+    static std::unique_ptr<EventLoop> create_loop(size_t index) {
+        auto loop = std::make_unique<EventLoop>();
+        loop->index = index;
+        loop->stopped = false;
+        loop->started = std::chrono::steady_clock::now();
+        wheel_init(&loop->wheel);
+
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (loop->epoll_fd < 0 || loop->wake_fd < 0) {
+            error::error("Failed to create event loop!");
+            std::exit(1);
+        }
+
+        // The wake-up fd is the only one registered without a client
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event);
+
+        return loop;
+    }
+
+    void loops_start(State *state, unsigned int threads) {
+        // Every loop is created by its own thread, once pinned, so its buffers and timer wheel are first touched (and
+        // allocated) on the thread's NUMA node
+        state->loops.resize(threads);
+        auto created = std::make_shared<std::latch>(threads + 1);
+
+        std::vector<std::thread> started;
+        for (unsigned int i = 0; i < threads; i++) {
+            started.emplace_back([state, i, created]() {
+                affinity::pin_thread(affinity::pool_cpus(state->config.affinity.io, i));
+                state->loops[i] = create_loop(i);
+
+                // Only run after every loop is in place, loops may post to each other
+                created->arrive_and_wait();
+                run(state->loops[i].get(), state);
+            });
+        }
+
+        created->arrive_and_wait();
+
+        for (unsigned int i = 0; i < threads; i++) {
+            state->loops[i]->thread = std::move(started[i]);
+        }
+    }
+
+    void loops_report(State *state) {
+        for (const auto &loop: state->loops) {
+            uint64_t local = loop->local_enqueues.exchange(0);
+            uint64_t remote = loop->remote_enqueues.exchange(0);
+            uint64_t total = local + remote;
+
+            std::cout << "Loop " << loop->index << ": lag " << loop->lag << "ms" <<
+                      ", longest pass " << loop->max_pass.exchange(0) << "us" <<
+                      ", budget yields " << loop->budget_yields <<
+                      ", cross-thread enqueues " << remote << "/" << total <<
+                      " (" << (total > 0 ? remote * 100 / total : 0) << "%)" <<
+                      ", migrations in " << loop->migrated_in << " out " << loop->migrated_out <<
+                      ", batched messages " << loop->batched_messages << " and wake-ups " << loop->batched_wakes <<
+                      " in " << loop->wake_batches << " posts" <<
+                      ", zero-copy sends " << loop->zerocopy_sends << " (" << loop->zerocopy_copied << " copied)" <<
+                      ", socket retunes " << loop->retuned_bulk << " to throughput " << loop->retuned_latency <<
+                      " to latency" <<
+                      ", shared memory frames " << loop->ring_frames <<
+                      std::endl;
+        }
+
+        std::cout << "Rebalancer: " << state->rebalancer.rounds << " rounds, " << state->rebalancer.moved <<
+                  " connections moved" << std::endl;
+    }
+
+    void loops_stop(State *state) {
+        for (auto &loop: state->loops) {
+            if (loop->thread.joinable()) {
+                loop->thread.join();
+            }
+        }
+
+        // Loops are kept (stopped) until the process exits, other threads may still try to post to them
+        for (auto &loop: state->loops) {
+            close(loop->epoll_fd);
+        }
+    }
+
+    //////////////
+    // Sessions //
+    //////////////
+
+    void attach(EventLoop *loop, const std::shared_ptr<Client> &client_ptr, State *state) {
+        client_ptr->io.loop = loop;
+
+        post(loop, [loop, client_ptr, state]() {
+            // Edge-triggered: the session coroutines drain the socket before waiting on it again
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.ptr = client_ptr.get();
+
+            if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_ptr->connection.socket_fd, &event) < 0) {
+                error::error("Failed to register client connection!");
+                client_ptr->alive = false;
+                close(client_ptr->connection.socket_fd);
+                client_ptr->connection.socket_fd = -1;
+                return;
+            }
+
+            loop->clients.insert(client_ptr);
+            communicator(client_ptr, state);
+        });
+    }
+
+    // Run work on the loop owning the client. If the client migrated before the work runs, it follows the client to
+    // its new loop.
+    static void post_client(const std::shared_ptr<Client> &client_ptr, std::function<void()> &&work) {
+        post(client_ptr->io.loop, [client_ptr, work = std::move(work)]() mutable {
+            if (client_ptr->io.loop != local_loop) {
+                post_client(client_ptr, std::move(work));
+                return;
+            }
+
+            work();
+        });
+    }
+
+    void wake_reader(const std::shared_ptr<Client> &client_ptr) {
+        post_client(client_ptr, [client_ptr]() {
+            resume(client_ptr->io.reader);
+        });
+    }
+
+    void wake_writer(const std::shared_ptr<Client> &client_ptr) {
+        // A wake-up is already pending, it will flush everything queued until it runs
+        if (client_ptr->io.writer_notified.exchange(true)) {
+            return;
+        }
+
+        post_client(client_ptr, [client_ptr]() {
+            client_ptr->io.writer_notified = false;
+            resume(client_ptr->io.writer);
+        });
+    }
+
+    static Mailbox &mailbox(FanoutBatch &batch, EventLoop *loop) {
+        if (batch.loops.size() <= loop->index) {
+            batch.loops.resize(loop->index + 1);
+        }
+
+        batch.loops[loop->index].loop = loop;
+        return batch.loops[loop->index];
+    }
+
+    void batch_message(FanoutBatch &batch, const std::shared_ptr<Client> &client_ptr) {
+        // Counted before the owning loop is read: a connection only migrates once none of its messages are left in a
+        // mailbox, so they are all queued by the loop they were posted to, in order
+        if (client_ptr->io.mail.fetch_add(1) & MAIL_MOVING) {
+            // Migrating, there is nothing in flight this message could overtake
+            client_ptr->io.mail.fetch_sub(1);
+            if (client_ptr->queue_message(batch.message, BULK)) {
+                batch_wake_writer(batch, client_ptr);
+            }
+            return;
+        }
+
+        mailbox(batch, client_ptr->io.loop).recipients.push_back(client_ptr);
+    }
+
+    void batch_wake_writer(FanoutBatch &batch, const std::shared_ptr<Client> &client_ptr) {
+        if (client_ptr->io.writer_notified.exchange(true)) {
+            return;
+        }
+
+        mailbox(batch, client_ptr->io.loop).wakes.push_back(client_ptr);
+    }
+
+    void post_batch(FanoutBatch &batch) {
+        for (auto &box: batch.loops) {
+            if (box.recipients.empty() && box.wakes.empty()) {
+                continue;
+            }
+            box.loop->wake_batches.fetch_add(1, std::memory_order_relaxed);
+
+            // Always through the posted queue, even from the loop itself: the batches of a channel reach every loop in
+            // the order they were posted (the ready queue runs after the posted one)
+            post_fifo(box.loop, [message = batch.message, recipients = std::move(box.recipients),
+                                 clients = std::move(box.wakes)]() mutable {
+                for (const auto &client_ptr: recipients) {
+                    if (client_ptr->queue_message(message, BULK) && !client_ptr->io.writer_notified.exchange(true)) {
+                        clients.push_back(client_ptr);
+                    }
+                    client_ptr->io.mail.fetch_sub(1);
+                }
+
+                local_loop->batched_messages.fetch_add(recipients.size(), std::memory_order_relaxed);
+                local_loop->batched_wakes.fetch_add(clients.size(), std::memory_order_relaxed);
+
+                for (const auto &client_ptr: clients) {
+                    // Moved to another loop in the meantime, follow it there
+                    if (client_ptr->io.loop != local_loop) {
+                        post_client(client_ptr, [client_ptr]() {
+                            client_ptr->io.writer_notified = false;
+                            resume(client_ptr->io.writer);
+                        });
+                        continue;
+                    }
+
+                    client_ptr->io.writer_notified = false;
+                    resume(client_ptr->io.writer);
+                }
+            });
+        }
+    }
+
+    void session_done(const std::shared_ptr<Client> &client_ptr, State *state) {
+        client_ptr->alive = false;
+
+        // The other coroutine is likely suspended, wake it so it notices the connection is gone
+        if (--client_ptr->io.coroutines > 0) {
+            wake_reader(client_ptr);
+            wake_writer(client_ptr);
+            return;
+        }
+
+        // Close the connection outside of the coroutine (its frame still references the client)
+        post_client(client_ptr, [client_ptr, state]() {
+            EventLoop *loop = client_ptr->io.loop;
+
+            if (client_ptr->connection.socket_fd >= 0) {
+                epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client_ptr->connection.socket_fd, nullptr);
+                close(client_ptr->connection.socket_fd);
+                client_ptr->connection.socket_fd = -1;
+            }
+
+            // The kernel may still be reading what was sent with zero-copy, and no completion will say when it's done
+            if (!client_ptr->io.zerocopy_inflight.empty()) {
+                post_after(loop, config::ZEROCOPY_LINGER, [held = std::move(client_ptr->io.zerocopy_inflight)]() {});
+                client_ptr->io.zerocopy_inflight.clear();
+            }
+
+            if (client_ptr->io.ring.header != nullptr) {
+                epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client_ptr->io.ring.event_fd, nullptr);
+                shmring::release(client_ptr->io.ring);
+            }
+
+            client_ptr->io.pending = {};
+            timer_cancel(&loop->wheel, &client_ptr->io.idle_timer);
+            timer_cancel(&loop->wheel, &client_ptr->io.throttle_timer);
+            loop->clients.erase(client_ptr);
+
+            teardown(client_ptr, state);
+        });
+    }
+
+    // Register the shared memory ring eventfd of the client on the loop, signals of new frames resume the reader like
+    // the socket does (it is only ever read)
+    static bool watch_ring(EventLoop *loop, Client *client) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = client;
+
+        return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client->io.ring.event_fd, &event) == 0;
+    }
+
+    void migrate(const std::shared_ptr<Client> &client_ptr, EventLoop *target, State *state) {
+        post_client(client_ptr, [client_ptr, target, state]() {
+            EventLoop *source = client_ptr->io.loop;
+            IoState &io = client_ptr->io;
+
+            // Nothing to move, or the session is already closing (one of its coroutines is done)
+            if (source == target || state->kill || !client_ptr->alive || io.coroutines < 2 ||
+                client_ptr->connection.socket_fd < 0) {
+                return;
+            }
+
+            // Broadcast messages still in this loop's mailbox must be queued first (a later one could reach the target
+            // before them), try again shortly. From here on, broadcasts queue their messages directly until it moved.
+            uint64_t mail = 0;
+            if (!io.mail.compare_exchange_strong(mail, MAIL_MOVING)) {
+                post_after(source, config::MIGRATE_RETRY, [client_ptr, target, state]() {
+                    migrate(client_ptr, target, state);
+                });
+                return;
+            }
+
+            // Both session coroutines are suspended (posted work never runs in the middle of one), so detaching the
+            // connection only takes its socket and timers off this loop
+            epoll_ctl(source->epoll_fd, EPOLL_CTL_DEL, client_ptr->connection.socket_fd, nullptr);
+            if (io.ring.header != nullptr) {
+                epoll_ctl(source->epoll_fd, EPOLL_CTL_DEL, io.ring.event_fd, nullptr);
+            }
+            timer_cancel(&source->wheel, &io.idle_timer);
+            timer_cancel(&source->wheel, &io.throttle_timer);
+            source->clients.erase(client_ptr);
+            source->migrated_out++;
+
+            // From now on, work posted for the client (even the one already on its way here) goes to the target
+            io.loop = target;
+
+            post(target, [client_ptr, target]() {
+                IoState &io = client_ptr->io;
+
+                // Closed in the meantime
+                if (client_ptr->connection.socket_fd < 0) {
+                    return;
+                }
+
+                epoll_event event{};
+                event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                event.data.ptr = client_ptr.get();
+
+                bool ring_failed = io.ring.header != nullptr && !watch_ring(target, client_ptr.get());
+                if (epoll_ctl(target->epoll_fd, EPOLL_CTL_ADD, client_ptr->connection.socket_fd, &event) < 0 ||
+                    ring_failed) {
+                    error::error("Failed to move client connection!");
+                    client_ptr->alive = false;
+                } else {
+                    target->clients.insert(client_ptr);
+                    target->migrated_in++;
+                }
+
+                // The idle check re-arms itself from here
+                if (io.idle_timer.callback) {
+                    loop_timer(target, &io.idle_timer, std::chrono::milliseconds(0));
+                }
+
+                // Let both coroutines re-check their state here (a throttled reader resumes early and waits again)
+                resume(io.reader);
+                resume(io.writer);
+            });
+
+            // Mailboxes posted from now on are queued after the target took the connection over
+            io.mail.fetch_and(~MAIL_MOVING);
+        });
+    }
+
+    bool attach_ring(Client *client, int memfd, int event_fd, int space_fd) {
+        IoState &io = client->io;
+
+        if (!shmring::attach(io.ring, memfd, event_fd, space_fd)) {
+            return false;
+        }
+
+        if (!watch_ring(io.loop, client)) {
+            shmring::release(io.ring);
+            return false;
+        }
+
+        return true;
+    }
+
+    void count_enqueue(Client *client) {
+        EventLoop *loop = client->io.loop;
+
+        if (loop == local_loop) {
+            loop->local_enqueues.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            loop->remote_enqueues.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    ////////////////
+    // Awaitables //
+    ////////////////
+
+    // Give up the connection's turn, resuming it from the back of the loop ready queue (the rest of the ready
+    // connections, and whatever the next poll brings, run first)
+    static void yield(Client *client, std::coroutine_handle<> IoState::*slot) {
+        client->io.loop.load()->budget_yields++;
+
+        post_client(client->shared_from_this(), [client_ptr = client->shared_from_this(), slot]() {
+            resume(client_ptr->io.*slot);
+        });
+    }
+
+    // Next frame of the client: from its shared memory ring first (if it has one), then from its socket. Frames of
+    // Unix domain sockets may come with fds (the ring handshake).
+    static int read_next(Client *client, char *buffer) {
+        IoState &io = client->io;
+
+        while (true) {
+            if (io.ring.header != nullptr) {
+                int result = shmring::read(io.ring, buffer, config::MAX_MESSAGE_SIZE);
+                if (result == -1) {
+                    error::error("Corrupted shared memory ring!");
+                    return -1;
+                }
+
+                if (result > 0) {
+                    io.loop.load()->ring_frames.fetch_add(1, std::memory_order_relaxed);
+                    return result;
+                }
+            }
+
+            int socket_fd = client->connection.socket_fd;
+            int result = client->connection.client_address.sin_family == AF_UNIX
+                         ? network::read_message_fds(socket_fd, buffer, io.passed_fds)
+                         : network::read_message(socket_fd, buffer);
+
+            // Both are dry, have the client signal its next frame (unless one came in meanwhile)
+            if (result == -2 && io.ring.header != nullptr && !shmring::sleep(io.ring)) {
+                continue;
+            }
+
+            return result;
+        }
+    }
+
+    bool ReadFrame::await_ready() {
+        IoState &io = this->client->io;
+
+        // The reader used up its budget for this pass, let the other connections run first
+        if (this->budget > 0 && io.read_streak >= this->budget) {
+            io.read_streak = 0;
+            this->yielded = true;
+            return false;
+        }
+
+        this->result = read_next(this->client, io.loop.load()->buffer);
+        return this->result != -2;
+    }
+
+    void ReadFrame::await_suspend(std::coroutine_handle<> handle) {
+        this->client->io.reader = handle;
+
+        if (this->yielded) {
+            yield(this->client, &IoState::reader);
+        } else {
+            this->client->io.read_streak = 0;
+        }
+    }
+
+    int ReadFrame::await_resume() {
+        // Resumed after waiting, the socket is likely readable now (still -2 on a spurious wake-up)
+        if (this->result == -2 && this->client->alive) {
+            EventLoop *loop = this->client->io.loop;
+            this->result = read_next(this->client, loop->buffer);
+        }
+
+        if (this->result > 0) {
+            this->client->io.read_streak++;
+            this->client->io.work.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return this->result;
+    }
+
+    ReadFrame read_frame(Client *client, unsigned int budget) {
+        return ReadFrame{client, budget, false, -2};
+    }
+
+    // Release the messages of the zero-copy sends the kernel is done with, false on errors
+    static bool reap_zerocopy(Client *client) {
+        IoState &io = client->io;
+        EventLoop *loop = io.loop;
+
+        uint32_t first;
+        uint32_t last;
+        bool copied;
+        int result;
+        while ((result = network::zerocopy_completion(client->connection.socket_fd, first, last, copied)) > 0) {
+            // (ids wrap around)
+            std::erase_if(io.zerocopy_inflight, [first, last](const std::pair<uint32_t, Frame> &send) {
+                return send.first - first <= last - first;
+            });
+
+            // The kernel copied the messages after all (loopback, or a device without scatter-gather), pinning them
+            // was only overhead, the connection goes back to normal sends
+            if (copied) {
+                loop->zerocopy_copied += last - first + 1;
+                io.zerocopy = 0;
+            }
+        }
+
+        return result == 0;
+    }
+
+    // Send the queued messages until the queue or the socket buffer runs dry (or the budget is used up), returns
+    // whether the writer is done waiting (like Flush::await_ready)
+    static bool send_messages(Flush *flush, bool &corked) {
+        Client *client = flush->client;
+        IoState &io = client->io;
+        size_t sent = 0;
+
+        while (client->alive) {
+            // The writer used up its budget for this pass, let the other connections run first
+            if (flush->budget > 0 && sent >= flush->budget) {
+                flush->yielded = true;
+                return false;
+            }
+
+            // Pick the next message once the current one is fully sent
+            if (!io.pending) {
+                io.pending = client->pop_message();
+                io.pending_offset = 0;
+
+                // Nothing left to send, wait for new messages
+                if (!io.pending) {
+                    return false;
+                }
+
+                // Several messages in one pass leave in full segments (throughput tuning), so the socket is corked
+                // from the second one on
+                if (io.cork && sent > 0 && !corked) {
+                    network::set_cork(client->connection.socket_fd, true);
+                    corked = true;
+                }
+            }
+
+            iovec slices[2];
+            int count = io.pending.slices(io.pending_offset, slices);
+
+            // Big messages are left in place for the kernel to read, instead of being copied to the socket buffer
+            int flags = io.zerocopy > 0 && io.pending.size() >= io.zerocopy ? MSG_ZEROCOPY : 0;
+            int result = network::send_gather(client->connection.socket_fd, slices, count, flags);
+
+            // Too many zero-copy sends in flight, copy this one
+            if (result == -3) {
+                flags = 0;
+                result = network::send_gather(client->connection.socket_fd, slices, count);
+            }
+
+            // Socket buffer is full, wait until it is writable again
+            if (result == -2) {
+                return false;
+            }
+
+            // Likely unrecoverable error, abort already
+            if (result == -1) {
+                flush->failed = true;
+                return true;
+            }
+
+            // Keep the message alive until the kernel is done with it
+            if (flags != 0) {
+                io.zerocopy_inflight.emplace_back(io.zerocopy_next++, io.pending);
+                io.loop.load()->zerocopy_sends++;
+            }
+
+            sent += result;
+            io.sent_bytes += result;
+            io.pending_offset += result;
+            if (io.pending_offset >= io.pending.size()) {
+                io.pending = {};
+                io.work.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        return true;
+    }
+
+    bool Flush::await_ready() {
+        IoState &io = this->client->io;
+
+        // Completions come through the error queue, which also wakes the writer up
+        if (!io.zerocopy_inflight.empty() && !reap_zerocopy(this->client)) {
+            this->failed = true;
+            return true;
+        }
+
+        bool corked = false;
+        bool ready = send_messages(this, corked);
+
+        // Whatever is left of the last segment goes out now
+        if (corked) {
+            network::set_cork(this->client->connection.socket_fd, false);
+        }
+
+        return ready;
+    }
+
+    void Flush::await_suspend(std::coroutine_handle<> handle) {
+        this->client->io.writer = handle;
+
+        if (this->yielded) {
+            yield(this->client, &IoState::writer);
+        }
+    }
+
+    bool Flush::await_resume() {
+        return !this->failed && this->client->alive;
+    }
+
+    Flush flush(Client *client, size_t budget) {
+        return Flush{client, budget, false, false};
+    }
+
+    bool Throttle::await_ready() {
+        return this->delay.count() <= 0 || !this->client->alive;
+    }
+
+    void Throttle::await_suspend(std::coroutine_handle<> handle) {
+        IoState &io = this->client->io;
+        io.reader = handle;
+
+        // The timer is cancelled once the reader resumes, a raw pointer is enough
+        Client *client = this->client;
+        io.throttle_timer.callback = [client]() { resume(client->io.reader); };
+        loop_timer(io.loop, &io.throttle_timer, this->delay);
+    }
+
+    void Throttle::await_resume() {
+        // Woken up early (e.g. the client is going away), the pause is over anyway
+        timer_cancel(&this->client->io.loop.load()->wheel, &this->client->io.throttle_timer);
+    }
+
+    Throttle throttle(Client *client, std::chrono::milliseconds delay) {
+        return Throttle{client, delay};
+    }
+}
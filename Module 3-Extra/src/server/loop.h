@@ -0,0 +1,285 @@
+#pragma once
+
+#include<atomic>
+#include<chrono>
+#include<coroutine>
+#include<deque>
+#include<exception>
+#include<functional>
+#include<memory>
+#include<mutex>
+#include<set>
+#include<thread>
+#include<vector>
+
+#include "../common/config.h"
+#include "../common/shmring.h"
+
+#include "outbound.h"
+#include "timer.h"
+
+namespace worker::server {
+    struct Client;
+    struct State;
+    struct EventLoop;
+
+    // Fire-and-forget coroutine, its frame is released as soon as it returns
+    struct Coroutine {
+        struct promise_type {
+            Coroutine get_return_object() { return {}; }
+
+            std::suspend_never initial_suspend() noexcept { return {}; }
+
+            std::suspend_never final_suspend() noexcept { return {}; }
+
+            void return_void() {}
+
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    // Per connection I/O bookkeeping, only touched by the owning loop thread (except the notified flag)
+    static const uint64_t MAIL_MOVING = 1ull << 63;
+
+    struct IoState {
+        // Loop owning the connection, changed (by its current owner) when the connection migrates
+        std::atomic<EventLoop *> loop;
+
+        // Suspended session coroutines, waiting to be resumed by the loop
+        std::coroutine_handle<> reader;
+        std::coroutine_handle<> writer;
+
+        // Session coroutines still running, the connection is closed once both are done
+        int coroutines;
+
+        // Is there a writer wake-up already on its way (avoids one post per queued message)
+        std::atomic<bool> writer_notified;
+
+        // Broadcast messages on their way through the mailbox of the owning loop, plus MAIL_MOVING while the connection
+        // migrates (broadcasts queue the messages directly meanwhile)
+        std::atomic<uint64_t> mail;
+
+        // Frames read without waiting since the reader last gave up its turn
+        unsigned int read_streak;
+
+        // Frames read & messages sent so far (the connection's share of its loop work, for the rebalancer)
+        std::atomic<uint64_t> work;
+
+        // Message currently being flushed, and how much of it was already sent
+        Frame pending;
+        size_t pending_offset;
+
+        // Zero-copy sends: size from which messages are sent with MSG_ZEROCOPY (0 if the socket doesn't use it), id of
+        // the next send, and the messages of the sends the kernel may still be reading
+        size_t zerocopy;
+        uint32_t zerocopy_next;
+        std::deque<std::pair<uint32_t, Frame> > zerocopy_inflight;
+
+        // Socket tuning: cork flushes of several messages, has the connection the throughput settings (adaptive
+        // profile), and bytes sent so far & at the last tuning check
+        bool cork;
+        bool bulk;
+        uint64_t sent_bytes;
+        uint64_t sent_sampled;
+
+        // Shared memory ring of a same-host client (header is null without one), and the fds passed along with the
+        // last frame read from a Unix domain socket
+        shmring::Ring ring;
+        std::vector<int> passed_fds;
+
+        // Last time a frame was received from the client (ms on the steady clock)
+        uint64_t last_activity;
+        // When the client was pinged, if the ping is still unanswered (ms on the steady clock, 0 otherwise)
+        uint64_t pinged_at;
+        // Last time the peer TCP acknowledgements proved it alive after an unanswered ping (ms on the steady clock)
+        uint64_t acked_at;
+        // Idle check (timeouts & keepalive pings)
+        Timer idle_timer;
+        // Resumes the reader once a throttle pause is over
+        Timer throttle_timer;
+    };
+
+    struct EventLoop {
+        size_t index;
+        std::thread thread;
+
+        int epoll_fd;
+        // eventfd used to wake the loop when work is posted from another thread
+        int wake_fd;
+
+        // Work posted from other threads
+        std::mutex posted_mutex;
+        std::vector<std::function<void()> > posted;
+        bool stopped;
+
+        // Work scheduled from the loop thread itself
+        std::deque<std::function<void()> > ready;
+
+        // Timers of the loop, ticking every config::TIMER_TICK since the loop started
+        TimingWheel wheel;
+        std::chrono::steady_clock::time_point started;
+
+        // Lag probe: when the pending probe was posted (0 if none) and how late the last one ran (ms)
+        std::atomic<uint64_t> probe_sent;
+        std::atomic<uint64_t> lag;
+
+        // Fairness metrics: turns given up by connections past their budget, and the longest pass (us) since the
+        // last report (how long a ready connection may have to wait)
+        std::atomic<uint64_t> budget_yields;
+        std::atomic<uint64_t> max_pass;
+
+        // Placement metrics: messages queued to the loop connections from their own loop or from another thread
+        // (cross-core traffic) since the last report, and connections moved in & out
+        std::atomic<uint64_t> local_enqueues;
+        std::atomic<uint64_t> remote_enqueues;
+        std::atomic<uint64_t> migrated_in;
+        std::atomic<uint64_t> migrated_out;
+
+        // Time spent running (not waiting on epoll) so far, in us
+        std::atomic<uint64_t> busy_us;
+
+        // Broadcast mailboxes: batches posted to the loop, the messages it queued to its connections from them and the
+        // writers they woke up
+        std::atomic<uint64_t> wake_batches;
+        std::atomic<uint64_t> batched_messages;
+        std::atomic<uint64_t> batched_wakes;
+
+        // Zero-copy sends, and the ones the kernel ended up copying anyway (loopback, some drivers)
+        std::atomic<uint64_t> zerocopy_sends;
+        std::atomic<uint64_t> zerocopy_copied;
+
+        // Frames read from shared memory rings
+        std::atomic<uint64_t> ring_frames;
+
+        // Connections switched to the throughput settings and back to the latency ones (adaptive tuning)
+        std::atomic<uint64_t> retuned_bulk;
+        std::atomic<uint64_t> retuned_latency;
+
+        // Connections owned by this loop
+        std::set<std::shared_ptr<Client> > clients;
+
+        // Receive buffer shared by every connection of the loop (the +1 simplifies null-terminating it)
+        char buffer[config::MAX_MESSAGE_SIZE + 1];
+    };
+
+    // Loop of the calling thread (nullptr if it isn't a loop thread)
+    EventLoop *current_loop();
+
+    // Run a function on the loop thread
+    void post(EventLoop *loop, std::function<void()> &&work);
+
+    // Run a function on the loop thread after (at least) the given delay
+    void post_after(EventLoop *loop, std::chrono::milliseconds delay, std::function<void()> &&work);
+
+    // Arm a timer on the loop wheel (loop thread only)
+    void loop_timer(EventLoop *loop, Timer *timer, std::chrono::milliseconds delay);
+
+    // Current time on the steady clock, in ms
+    uint64_t now_ms();
+
+    void loops_start(State *state, unsigned int threads);
+
+    void loops_stop(State *state);
+
+    // Print the fairness & placement metrics of every loop
+    void loops_report(State *state);
+
+    // Hand a new connection over to a loop, which starts its session
+    void attach(EventLoop *loop, const std::shared_ptr<Client> &client_ptr, State *state);
+
+    // Move a connection over to another loop, once its current loop gets to it (no-op if the connection is closing),
+    // safe from any thread
+    void migrate(const std::shared_ptr<Client> &client_ptr, EventLoop *target, State *state);
+
+    // Count a message queued to the connection (placement metrics), safe from any thread
+    void count_enqueue(Client *client);
+
+    // Resume a suspended session coroutine (no-op if it isn't suspended), safe from any thread
+    void wake_reader(const std::shared_ptr<Client> &client_ptr);
+
+    void wake_writer(const std::shared_ptr<Client> &client_ptr);
+
+    // What a fan-out has for one loop: the connections the loop queues the message to itself, in one pass, and the
+    // writers it wakes up
+    struct Mailbox {
+        EventLoop *loop;
+        std::vector<std::shared_ptr<Client> > recipients;
+        std::vector<std::shared_ptr<Client> > wakes;
+    };
+
+    // A fan-out gathered by loop, so every loop gets a single post (and at most one eventfd write) for all of its
+    // connections instead of a queue lock and a wake-up per recipient
+    struct FanoutBatch {
+        // Message of the fan-out (none if it only wakes writers up)
+        Frame message;
+        // Mailboxes by loop index
+        std::vector<Mailbox> loops;
+    };
+
+    // Add a recipient of the batch message, the message is queued by the loop owning the connection once posted (right
+    // away if the connection is migrating). Safe from any thread.
+    void batch_message(FanoutBatch &batch, const std::shared_ptr<Client> &client_ptr);
+
+    // Add a wake-up to the batch (no-op if one is already on its way to the writer)
+    void batch_wake_writer(FanoutBatch &batch, const std::shared_ptr<Client> &client_ptr);
+
+    // Post the gathered mailboxes, one batch per loop
+    void post_batch(FanoutBatch &batch);
+
+    // Map the shared memory ring passed by the client and watch its eventfd, the client frames are read from it as
+    // well as from the socket from then on. Takes over the fds (closed on failure). Loop thread only.
+    bool attach_ring(Client *client, int memfd, int event_fd, int space_fd);
+
+    // Called by each session coroutine when it returns
+    void session_done(const std::shared_ptr<Client> &client_ptr, State *state);
+
+    // Awaitable read of the next frame into the loop buffer. Resolves to the frame length, 0 on a closed connection,
+    // -1 on errors or -2 if the reader was woken up without a frame (e.g. to re-check the client state). Once the
+    // reader read `budget` frames in a row, it goes to the back of the loop ready queue before reading more.
+    struct ReadFrame {
+        Client *client;
+        unsigned int budget;
+        bool yielded;
+        int result;
+
+        bool await_ready();
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        int await_resume();
+    };
+
+    ReadFrame read_frame(Client *client, unsigned int budget);
+
+    // Awaitable flush of the client outbound queue. Sends until the queue is empty, the socket is full or `budget`
+    // bytes were sent (then it goes to the back of the loop ready queue), and then suspends until there is something
+    // else to do. Resolves to false if the connection died.
+    struct Flush {
+        Client *client;
+        size_t budget;
+        bool yielded;
+        bool failed;
+
+        bool await_ready();
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        bool await_resume();
+    };
+
+    Flush flush(Client *client, size_t budget);
+
+    // Awaitable pause of the reader, the socket isn't read until the delay is over (or the reader is woken up).
+    struct Throttle {
+        Client *client;
+        std::chrono::milliseconds delay;
+
+        bool await_ready();
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        void await_resume();
+    };
+
+    Throttle throttle(Client *client, std::chrono::milliseconds delay);
+}
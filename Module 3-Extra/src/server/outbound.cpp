@@ -0,0 +1,147 @@
+#include "outbound.h"
+
+namespace worker::server {
+    size_t Frame::size() const {
+        return (this->prefix ? this->prefix->size() : 0) + this->payload->size();
+    }
+
+    int Frame::slices(size_t offset, iovec *out) const {
+        int count = 0;
+
+        for (const auto &slice: {this->prefix.get(), this->payload.get()}) {
+            if (slice == nullptr) {
+                continue;
+            }
+
+            // Already sent
+            if (offset >= slice->size()) {
+                offset -= slice->size();
+                continue;
+            }
+
+            out[count].iov_base = const_cast<char *>(slice->data() + offset);
+            out[count].iov_len = slice->size() - offset;
+            offset = 0;
+            count++;
+        }
+
+        return count;
+    }
+
+    static bool fits(const OutboundQueue &queue, size_t size) {
+        return queue.count + 1 <= queue.limits.max_messages && queue.bytes + size <= queue.limits.max_bytes;
+    }
+
+    static void drop_front(OutboundQueue &queue, MessageKind kind) {
+        size_t size = queue.lanes[kind].front().size();
+
+        queue.lanes[kind].pop_front();
+        queue.count--;
+        queue.bytes -= size;
+        queue.dropped_messages++;
+        queue.dropped_bytes += size;
+    }
+
+    static PushResult drop_new(OutboundQueue &queue, const Frame &message, MessageKind kind) {
+        // Control messages answer the client's own commands, losing one would leave the client out of sync
+        if (kind == CONTROL) {
+            return OVERFLOW;
+        }
+
+        queue.dropped_messages++;
+        queue.dropped_bytes += message.size();
+        return DROPPED;
+    }
+
+    PushResult OutboundQueue::push(const Frame &message, MessageKind kind) {
+        auto guard = std::lock_guard<std::mutex>(this->mutex);
+        size_t before = this->bytes;
+
+        if (!fits(*this, message.size())) {
+            if (this->limits.policy == config::SlowConsumerPolicy::DISCONNECT) {
+                return OVERFLOW;
+            }
+
+            // Bigger than the whole queue, no amount of dropping makes room for it
+            if (message.size() > this->limits.max_bytes) {
+                return drop_new(*this, message, kind);
+            }
+
+            // Make room dropping the oldest bulk messages, control ones are never dropped
+            if (this->limits.policy == config::SlowConsumerPolicy::DROP_OLDEST) {
+                while (!this->lanes[BULK].empty() && !fits(*this, message.size())) {
+                    drop_front(*this, BULK);
+                }
+            }
+
+            if (!fits(*this, message.size())) {
+                return drop_new(*this, message, kind);
+            }
+        }
+
+        this->lanes[kind].push_back(message);
+        this->count++;
+        this->bytes += message.size();
+
+        if (this->total_bytes != nullptr) {
+            // (older messages may have been dropped to make room)
+            *this->total_bytes += this->bytes;
+            *this->total_bytes -= before;
+        }
+
+        return QUEUED;
+    }
+
+    Frame OutboundQueue::pop() {
+        auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+        // If the queue is empty, return an empty frame
+        if (this->count == 0) {
+            return {};
+        }
+
+        // Highest priority lane with messages, unless the bulk lane waited for too long
+        int lane = 0;
+        while (this->lanes[lane].empty()) {
+            lane++;
+        }
+
+        if (lane == CONTROL && !this->lanes[BULK].empty() && ++this->control_streak > config::CONTROL_BURST) {
+            lane = BULK;
+        }
+        if (lane != CONTROL || this->lanes[BULK].empty()) {
+            this->control_streak = 0;
+        }
+
+        // Get the front element and remove it from the lane
+        Frame message = std::move(this->lanes[lane].front());
+        this->lanes[lane].pop_front();
+        this->count--;
+        this->bytes -= message.size();
+
+        if (this->total_bytes != nullptr) {
+            *this->total_bytes -= message.size();
+        }
+
+        return message;
+    }
+
+    void OutboundQueue::clear() {
+        auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+        if (this->total_bytes != nullptr) {
+            *this->total_bytes -= this->bytes;
+        }
+
+        for (auto &lane: this->lanes) {
+            lane.clear();
+        }
+        this->count = 0;
+        this->bytes = 0;
+    }
+
+    bool OutboundQueue::backlogged() {
+        auto guard = std::lock_guard<std::mutex>(this->mutex);
+        return this->count > 0;
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include<atomic>
+#include<deque>
+#include<memory>
+#include<mutex>
+#include<string>
+
+#include<sys/uio.h>
+
+#include "../common/config.h"
+
+namespace worker::server {
+    // Control messages are direct responses to the client, bulk messages come from channel fan-out. Each kind has its
+    // own lane, in priority order.
+    enum MessageKind {
+        CONTROL,
+        BULK,
+        MESSAGE_KINDS,
+    };
+
+    // Message on its way to a client, sent as a gather of its slices: the sender's prefix ("nick: ", channel messages
+    // only) and the payload. Both buffers are immutable, every queue (and channel log) the message goes to shares them.
+    struct Frame {
+        std::shared_ptr<const std::string> prefix;
+        std::shared_ptr<const std::string> payload;
+
+        Frame() = default;
+        Frame(std::shared_ptr<const std::string> payload) : payload(std::move(payload)) {}
+        Frame(std::shared_ptr<std::string> payload) : payload(std::move(payload)) {}
+        Frame(std::shared_ptr<const std::string> prefix, std::shared_ptr<const std::string> payload)
+                : prefix(std::move(prefix)), payload(std::move(payload)) {}
+
+        explicit operator bool() const { return payload != nullptr; }
+
+        size_t size() const;
+
+        // Slices of what is left to send after the first `offset` bytes (at most 2), returns how many there are
+        int slices(size_t offset, iovec *out) const;
+    };
+
+    enum PushResult {
+        // The message was queued (possibly dropping older ones)
+        QUEUED,
+        // The message itself was dropped
+        DROPPED,
+        // The limits were hit and the policy asks for the consumer to be disconnected
+        OVERFLOW,
+    };
+
+    // Outbound message queue of a client, bounded in both message count and bytes. Control messages go ahead of the
+    // bulk ones, except that bulk messages get a turn every config::CONTROL_BURST control messages (so a client
+    // spamming commands still sees the channel). The slow consumer policy may drop bulk messages to stay within the
+    // limits, a control message that doesn't fit always overflows.
+    struct OutboundQueue {
+        std::mutex mutex;
+        std::deque<Frame> lanes[MESSAGE_KINDS];
+        size_t count = 0;
+        size_t bytes = 0;
+
+        // Control messages sent in a row while bulk ones were waiting
+        unsigned int control_streak = 0;
+
+        // Limits and what to do once they are hit
+        config::OutboundConfig limits;
+
+        // Server wide count of queued bytes, kept up to date by the queue (optional)
+        std::atomic<size_t> *total_bytes = nullptr;
+
+        // Messages (and their bytes) dropped because of the limits
+        std::atomic<uint64_t> dropped_messages = 0;
+        std::atomic<uint64_t> dropped_bytes = 0;
+
+        PushResult push(const Frame &message, MessageKind kind);
+
+        // Next message to be sent, an empty frame if the queue is empty
+        Frame pop();
+
+        void clear();
+
+        // Is anything waiting to be sent
+        bool backlogged();
+    };
+}
@@ -0,0 +1,151 @@
+#include<algorithm>
+#include<iostream>
+
+#include "../common/error.h"
+
+#include "worker.h"
+#include "overload.h"
+
+namespace worker::server {
+    static const char *LEVEL_NAMES[] = {"normal", "refusing connections", "pausing senders", "shedding messages"};
+
+    // Measure how late posted work runs on each loop. A probe that is still pending counts as lag too, so a stuck
+    // loop shows up right away.
+    static uint64_t sample_loop_lag(State *state) {
+        uint64_t now = now_ms();
+        uint64_t lag = 0;
+
+        for (const auto &loop_ptr: state->loops) {
+            EventLoop *loop = loop_ptr.get();
+
+            uint64_t sent = loop->probe_sent;
+            if (sent != 0) {
+                lag = std::max(lag, now - sent);
+                continue;
+            }
+
+            lag = std::max(lag, loop->lag.load());
+
+            loop->probe_sent = now;
+            post(loop, [loop, now]() {
+                loop->lag = now_ms() - now;
+                loop->probe_sent = 0;
+            });
+        }
+
+        return lag;
+    }
+
+    // How far past its threshold the worst signal is (1 is right at the threshold)
+    static double pressure(size_t value, size_t threshold) {
+        return threshold == 0 ? 0 : (double) value / (double) threshold;
+    }
+
+    // Sample what each client sent since the last check, and stop reading from the heaviest senders if asked to
+    static void sample_senders(State *state, bool pause) {
+        std::vector<std::pair<uint64_t, std::shared_ptr<Client> > > senders;
+
+        {
+            auto guard = std::lock_guard<std::mutex>(state->clients_mutex);
+
+            for (const auto &client_ptr: state->clients) {
+                uint64_t received = client_ptr->received_bytes;
+                uint64_t sent = received - client_ptr->received_sampled;
+                client_ptr->received_sampled = received;
+
+                if (sent > 0 && client_ptr->alive && !client_ptr->paused) {
+                    senders.emplace_back(sent, client_ptr);
+                }
+            }
+        }
+
+        if (!pause || senders.empty()) {
+            return;
+        }
+
+        size_t count = std::max<size_t>(1, senders.size() / config::OVERLOAD_PAUSE_SHARE);
+        std::partial_sort(senders.begin(), senders.begin() + (long) count, senders.end(),
+                          [](const auto &a, const auto &b) { return a.first > b.first; });
+
+        for (size_t i = 0; i < count; i++) {
+            senders[i].second->paused = true;
+            state->overload.paused.push_back(senders[i].second);
+            state->overload.paused_senders++;
+        }
+    }
+
+    static void resume_senders(State *state) {
+        for (const auto &entry: state->overload.paused) {
+            std::shared_ptr<Client> client_ptr = entry.lock();
+            if (client_ptr) {
+                client_ptr->paused = false;
+            }
+        }
+
+        state->overload.paused.clear();
+    }
+
+    void overload_check(State *state) {
+        Overload &overload = state->overload;
+        const config::OverloadConfig &limits = state->config.overload;
+
+        overload.handler_queue = state->pipeline.enabled ? state->pipeline.queued.load() : 0;
+        overload.loop_lag = sample_loop_lag(state);
+
+        double worst = std::max({pressure(overload.handler_queue, limits.handler_queue),
+                                 pressure(overload.outbound_bytes, limits.outbound_bytes),
+                                 pressure(overload.loop_lag, limits.loop_lag.count())});
+
+        // Every step starts further past the thresholds, and is only left once well below its own start (so the
+        // server doesn't flap between levels)
+        int target = worst >= 2 ? SHEDDING : worst >= 1.5 ? PAUSING : worst >= 1 ? REFUSING : NORMAL;
+        int level = overload.level;
+
+        if (target < level) {
+            double start = level == SHEDDING ? 2 : level == PAUSING ? 1.5 : 1;
+            if (worst >= start * 0.75) {
+                target = level;
+            }
+        }
+
+        if (target != level) {
+            overload.level = target;
+            overload.transitions++;
+
+            error::warning(std::string("Overload level is now ") + LEVEL_NAMES[target] + " (handler queue " +
+                           std::to_string(overload.handler_queue) + ", outbound bytes " +
+                           std::to_string(overload.outbound_bytes) + ", loop lag " +
+                           std::to_string(overload.loop_lag) + "ms)");
+        }
+
+        // Keep pausing the heaviest senders while the server doesn't recover, let them go once it does. The senders
+        // are sampled as soon as the server is under pressure, so the first pause already picks the recent ones.
+        if (target >= REFUSING) {
+            sample_senders(state, target >= PAUSING);
+        }
+        if (target < PAUSING && !overload.paused.empty()) {
+            resume_senders(state);
+        }
+
+        if (overload.report.exchange(false)) {
+            overload_report(state);
+        }
+
+        post_after(state->loops[0].get(), config::OVERLOAD_INTERVAL, [state]() { overload_check(state); });
+    }
+
+    void overload_report(State *state) {
+        Overload &overload = state->overload;
+
+        std::cout << "Overload: level " << LEVEL_NAMES[overload.level] <<
+                  ", handler queue " << overload.handler_queue <<
+                  ", outbound bytes " << overload.outbound_bytes <<
+                  ", loop lag " << overload.loop_lag << "ms" <<
+                  ", transitions " << overload.transitions <<
+                  ", refused connections " << overload.refused_connections <<
+                  ", paused senders " << overload.paused_senders << " (" << overload.paused.size() << " now)" <<
+                  ", shed messages " << overload.shed_messages << std::endl;
+
+        loops_report(state);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include<atomic>
+#include<cstdint>
+#include<memory>
+#include<vector>
+
+namespace worker::server {
+    struct Client;
+    struct State;
+
+    // Load shedding steps, each level also applies the previous ones
+    enum OverloadLevel {
+        NORMAL,
+        // New connections are refused
+        REFUSING,
+        // The heaviest senders aren't read from
+        PAUSING,
+        // Channel messages to clients that are already behind are dropped
+        SHEDDING,
+    };
+
+    struct Overload {
+        std::atomic<int> level;
+
+        // Bytes waiting on every client outbound queue
+        std::atomic<size_t> outbound_bytes;
+
+        // Last sampled signals
+        std::atomic<size_t> handler_queue;
+        std::atomic<uint64_t> loop_lag;
+
+        // Metrics of each step
+        std::atomic<uint64_t> transitions;
+        std::atomic<uint64_t> refused_connections;
+        std::atomic<uint64_t> paused_senders;
+        std::atomic<uint64_t> shed_messages;
+
+        // Print the metrics on the next check (SIGUSR1)
+        std::atomic<bool> report;
+
+        // Senders currently paused (controller only)
+        std::vector<std::weak_ptr<Client> > paused;
+    };
+
+    // Sample the server and move between levels, runs periodically on the first loop
+    void overload_check(State *state);
+
+    void overload_report(State *state);
+}
@@ -0,0 +1,172 @@
+#include "../common/config.h"
+
+#include "worker.h"
+#include "pipeline.h"
+
+namespace worker::server {
+    // Max commands executed for a client before giving the handler to others
+    static const int HANDLER_BATCH = 16;
+
+    /////////////////////
+    // Handler Threads //
+    /////////////////////
+
+    void pipeline_start(State *state, unsigned int threads, size_t capacity) {
+        state->pipeline.queued = 0;
+        state->pipeline.capacity = capacity;
+        state->pipeline.enabled = threads > 0;
+
+        if (state->pipeline.enabled) {
+            scheduler_start(&state->pipeline.scheduler, threads, state->config.affinity.handler);
+        }
+
+        // Without handlers, big broadcasts still need somewhere to run besides the sender's loop
+        state->pipeline.fanout_enabled = !state->pipeline.enabled && state->config.fanout_threshold > 0 &&
+                                         state->config.fanout_threads > 0;
+
+        if (state->pipeline.fanout_enabled) {
+            scheduler_start(&state->pipeline.fanout, state->config.fanout_threads, state->config.affinity.handler);
+        }
+    }
+
+    void pipeline_stop(State *state) {
+        if (state->pipeline.enabled) {
+            scheduler_stop(&state->pipeline.scheduler);
+            state->pipeline.enabled = false;
+        }
+
+        if (state->pipeline.fanout_enabled) {
+            scheduler_stop(&state->pipeline.fanout);
+            state->pipeline.fanout_enabled = false;
+        }
+    }
+
+    Scheduler *fanout_pool(State *state) {
+        if (state->config.fanout_threshold == 0) {
+            return nullptr;
+        }
+
+        if (state->pipeline.enabled) {
+            return &state->pipeline.scheduler;
+        }
+
+        return state->pipeline.fanout_enabled ? &state->pipeline.fanout : nullptr;
+    }
+
+    static void release_capacity(State *state) {
+        state->pipeline.queued--;
+
+        std::shared_ptr<Client> waiting = nullptr;
+
+        {
+            auto guard = std::lock_guard<std::mutex>(state->pipeline.mutex);
+
+            if (!state->pipeline.waiting.empty()) {
+                waiting = state->pipeline.waiting.front();
+                state->pipeline.waiting.pop_front();
+                waiting->waiting_dispatch = false;
+            }
+        }
+
+        // Let a held back reader retry
+        if (waiting) {
+            wake_reader(waiting);
+        }
+    }
+
+    // Execute the commands of a single client. Only one of these tasks exists per client at a time, which keeps
+    // the client's commands in order while different clients are spread (and stolen) across the handlers.
+    static void run_commands(const std::shared_ptr<Client> &client_ptr, State *state) {
+        for (int i = 0; i < HANDLER_BATCH; i++) {
+            std::string message;
+
+            {
+                auto guard = std::lock_guard<std::mutex>(client_ptr->commands_mutex);
+
+                if (client_ptr->commands.empty()) {
+                    client_ptr->commands_scheduled = false;
+                    return;
+                }
+
+                message = std::move(client_ptr->commands.front());
+                client_ptr->commands.pop_front();
+            }
+
+            release_capacity(state);
+
+            // The client may have quit or died while the command was waiting, drop it
+            if (client_ptr->alive) {
+                handle(message, client_ptr, state);
+            }
+        }
+
+        // Batch exhausted, requeue the client behind the other pending work
+        spawn(&state->pipeline.scheduler, [client_ptr, state]() { run_commands(client_ptr, state); });
+    }
+
+    //////////////
+    // Dispatch //
+    //////////////
+
+    bool dispatch(const std::string &message, const std::shared_ptr<Client> &client_ptr, State *state) {
+        // Without the pipeline mode the command runs on the calling I/O thread
+        if (!state->pipeline.enabled) {
+            handle(message, client_ptr, state);
+            return true;
+        }
+
+        // The handlers are stopping, drop it
+        if (state->kill) {
+            return true;
+        }
+
+        // Hold the reader back while the handlers are behind
+        {
+            auto guard = std::lock_guard<std::mutex>(state->pipeline.mutex);
+
+            if (state->pipeline.queued >= state->pipeline.capacity) {
+                return false;
+            }
+
+            state->pipeline.queued++;
+        }
+
+        bool schedule = false;
+
+        {
+            auto guard = std::lock_guard<std::mutex>(client_ptr->commands_mutex);
+            client_ptr->commands.push_back(message);
+
+            if (!client_ptr->commands_scheduled) {
+                client_ptr->commands_scheduled = true;
+                schedule = true;
+            }
+        }
+
+        if (schedule) {
+            spawn(&state->pipeline.scheduler, [client_ptr, state]() { run_commands(client_ptr, state); });
+        }
+
+        return true;
+    }
+
+    bool WaitDispatch::await_suspend(std::coroutine_handle<> handle) {
+        auto guard = std::lock_guard<std::mutex>(this->state->pipeline.mutex);
+
+        // Room was made in the meantime, don't suspend
+        if (this->state->pipeline.queued < this->state->pipeline.capacity) {
+            return false;
+        }
+
+        this->client->io.reader = handle;
+        if (!this->client->waiting_dispatch) {
+            this->client->waiting_dispatch = true;
+            this->state->pipeline.waiting.push_back(this->client);
+        }
+        return true;
+    }
+
+    WaitDispatch wait_dispatch(const std::shared_ptr<Client> &client_ptr, State *state) {
+        return WaitDispatch{client_ptr, state};
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include<atomic>
+#include<coroutine>
+#include<deque>
+#include<memory>
+#include<mutex>
+#include<string>
+
+#include "scheduler.h"
+
+namespace worker::server {
+    struct Client;
+    struct State;
+
+    struct Pipeline {
+        // Handler threads, executing the commands decoded by the I/O threads
+        Scheduler scheduler;
+        bool enabled;
+
+        // Commands waiting for a handler, the readers are held back once the capacity is reached
+        std::atomic<size_t> queued;
+        size_t capacity;
+
+        // Readers waiting for room in the queue
+        std::mutex mutex;
+        std::deque<std::shared_ptr<Client> > waiting;
+
+        // Threads fanning big broadcasts out when the pipeline mode is off (the handlers do it otherwise)
+        Scheduler fanout;
+        bool fanout_enabled;
+    };
+
+    // Awaitable suspending a reader until the handlers have room for more commands
+    struct WaitDispatch {
+        std::shared_ptr<Client> client;
+        State *state;
+
+        bool await_ready() { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle);
+
+        void await_resume() {}
+    };
+
+    void pipeline_start(State *state, unsigned int threads, size_t capacity);
+
+    void pipeline_stop(State *state);
+
+    // Threads big broadcasts are fanned out on (nullptr if there are none)
+    Scheduler *fanout_pool(State *state);
+
+    // Execute a command, either right away or on a handler thread. Returns false (and drops nothing) if the
+    // handlers are full, in which case the reader should wait on `wait_dispatch` and try again.
+    bool dispatch(const std::string &message, const std::shared_ptr<Client> &client_ptr, State *state);
+
+    WaitDispatch wait_dispatch(const std::shared_ptr<Client> &client_ptr, State *state);
+}
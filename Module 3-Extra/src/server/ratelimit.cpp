@@ -0,0 +1,37 @@
+#include<algorithm>
+#include<cmath>
+
+#include "ratelimit.h"
+
+namespace worker::server {
+    void rate_limits_set(RateLimits *limits, const config::RateLimitConfig &config) {
+        limits->chat_rate = config.chat_rate;
+        limits->chat_burst = config.chat_burst;
+        limits->command_rate = config.command_rate;
+        limits->command_burst = config.command_burst;
+    }
+
+    std::chrono::milliseconds bucket_take(TokenBucket *bucket, unsigned int rate, unsigned int burst, uint64_t now) {
+        // No limit
+        if (rate == 0) {
+            return std::chrono::milliseconds(0);
+        }
+
+        double capacity = std::max(burst, 1u);
+
+        // New buckets start full, the others are refilled for the time elapsed since they were last used
+        if (bucket->updated == 0) {
+            bucket->tokens = capacity;
+        } else {
+            bucket->tokens = std::min(capacity, bucket->tokens + (double) (now - bucket->updated) * rate / 1000);
+        }
+        bucket->updated = now;
+
+        if (bucket->tokens >= 1) {
+            bucket->tokens -= 1;
+            return std::chrono::milliseconds(0);
+        }
+
+        return std::chrono::milliseconds((int64_t) std::ceil((1 - bucket->tokens) * 1000 / rate));
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include<atomic>
+#include<chrono>
+#include<cstdint>
+
+#include "../common/config.h"
+
+namespace worker::server {
+    // Inbound rate limits in effect, adjustable while the server runs
+    struct RateLimits {
+        std::atomic<unsigned int> chat_rate;
+        std::atomic<unsigned int> chat_burst;
+        std::atomic<unsigned int> command_rate;
+        std::atomic<unsigned int> command_burst;
+    };
+
+    // Token bucket, refilled continuously at the limit rate up to its burst (only touched by the client reader)
+    struct TokenBucket {
+        double tokens = 0;
+        // Last refill (ms on the steady clock, 0 if the bucket was never used)
+        uint64_t updated = 0;
+    };
+
+    void rate_limits_set(RateLimits *limits, const config::RateLimitConfig &config);
+
+    // Take a token from the bucket. Returns 0 if one was taken, otherwise how long until one is available.
+    std::chrono::milliseconds bucket_take(TokenBucket *bucket, unsigned int rate, unsigned int burst, uint64_t now);
+}
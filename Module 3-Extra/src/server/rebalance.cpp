@@ -0,0 +1,177 @@
+#include<algorithm>
+#include<iostream>
+#include<unordered_map>
+
+#include "worker.h"
+#include "rebalance.h"
+
+namespace worker::server {
+    // Something that can be moved to another loop: a connection, or a whole channel (placement by channel)
+    struct Unit {
+        uint64_t work;
+        std::shared_ptr<Client> client;
+        std::shared_ptr<Channel> channel;
+    };
+
+    // Connections, by the work they did since the last check
+    using ClientWork = std::unordered_map<Client *, std::pair<uint64_t, std::shared_ptr<Client> > >;
+
+    // Work done for each connection since the last check. Every connection is sampled on every check, so the next
+    // deltas only cover one interval.
+    static ClientWork sample_clients(State *state) {
+        ClientWork clients;
+
+        auto guard = std::lock_guard<std::mutex>(state->clients_mutex);
+
+        for (const auto &client_ptr: state->clients) {
+            uint64_t work = client_ptr->io.work;
+            uint64_t done = work - client_ptr->work_sampled;
+            client_ptr->work_sampled = work;
+
+            if (client_ptr->alive) {
+                clients[client_ptr.get()] = {done, client_ptr};
+            }
+        }
+
+        return clients;
+    }
+
+    // Channels gathered on the loop, weighted by the work of their members
+    static std::vector<Unit> channel_units(State *state, EventLoop *loop, const ClientWork &clients) {
+        // Snapshot the channels first, a channel lock is never taken while holding the channels one
+        std::vector<std::shared_ptr<Channel> > channels;
+        {
+            auto guard = std::lock_guard<std::mutex>(state->channels_mutex);
+
+            for (const auto &entry: state->channels) {
+                if (entry.second->loop == loop) {
+                    channels.push_back(entry.second);
+                }
+            }
+        }
+
+        std::vector<Unit> units;
+        for (const auto &channel: channels) {
+            auto guard = std::lock_guard<std::mutex>(channel->mutex);
+
+            uint64_t work = 0;
+            for (const auto &member: channel->members) {
+                auto it = clients.find(member.get());
+                if (it != clients.end()) {
+                    work += it->second.first;
+                }
+            }
+
+            units.push_back({work, nullptr, channel});
+        }
+
+        return units;
+    }
+
+    static size_t move_unit(State *state, const Unit &unit, EventLoop *target) {
+        if (unit.client) {
+            migrate(unit.client, target, state);
+            return 1;
+        }
+
+        // The members are moved over, and the ones joining later go straight to the new loop
+        std::vector<std::shared_ptr<Client> > members;
+        {
+            auto guard = std::lock_guard<std::mutex>(unit.channel->mutex);
+            unit.channel->loop = target;
+            members.assign(unit.channel->members.begin(), unit.channel->members.end());
+        }
+
+        for (const auto &member: members) {
+            migrate(member, target, state);
+        }
+
+        return members.size();
+    }
+
+    void rebalance_check(State *state) {
+        Rebalancer &rebalancer = state->rebalancer;
+        size_t loops = state->loops.size();
+        uint64_t interval = std::chrono::duration_cast<std::chrono::microseconds>(config::REBALANCE_INTERVAL).count();
+
+        // Busy share of each loop since the last check (%)
+        std::vector<uint64_t> shares(loops);
+        rebalancer.busy_sampled.resize(loops, 0);
+
+        size_t busiest = 0;
+        size_t idlest = 0;
+        for (size_t i = 0; i < loops; i++) {
+            uint64_t busy = state->loops[i]->busy_us;
+            shares[i] = (busy - rebalancer.busy_sampled[i]) * 100 / interval;
+            rebalancer.busy_sampled[i] = busy;
+
+            if (shares[i] > shares[busiest]) {
+                busiest = i;
+            }
+            if (shares[i] < shares[idlest]) {
+                idlest = i;
+            }
+        }
+
+        auto clients = sample_clients(state);
+        post_after(state->loops[0].get(), config::REBALANCE_INTERVAL, [state]() { rebalance_check(state); });
+
+        if (shares[busiest] - shares[idlest] < state->config.rebalance_threshold || state->kill) {
+            return;
+        }
+
+        EventLoop *source = state->loops[busiest].get();
+        EventLoop *target = state->loops[idlest].get();
+
+        // What the busiest loop did, connections and channels alike are weighted by the work of their connections
+        uint64_t total = 0;
+        std::vector<Unit> units;
+        for (const auto &entry: clients) {
+            const auto &[work, client_ptr] = entry.second;
+            if (client_ptr->io.loop != source) {
+                continue;
+            }
+
+            total += work;
+            if (state->config.placement != config::Placement::CHANNEL) {
+                units.push_back({work, client_ptr, nullptr});
+            }
+        }
+
+        if (state->config.placement == config::Placement::CHANNEL) {
+            units = channel_units(state, source, clients);
+        }
+
+        // Even the loads out: move half the difference, heaviest units first, skipping the ones that would just make
+        // the target the new busiest loop
+        uint64_t goal = total * (shares[busiest] - shares[idlest]) / 2 / std::max<uint64_t>(shares[busiest], 1);
+        std::sort(units.begin(), units.end(), [](const Unit &a, const Unit &b) { return a.work > b.work; });
+
+        uint64_t planned = 0;
+        size_t moves = 0;
+        size_t moved = 0;
+        for (const auto &unit: units) {
+            if (moves >= config::REBALANCE_MAX_MOVES) {
+                break;
+            }
+
+            if (unit.work == 0 || planned + unit.work > goal) {
+                continue;
+            }
+
+            planned += unit.work;
+            moves++;
+            moved += move_unit(state, unit, target);
+        }
+
+        if (moved == 0) {
+            return;
+        }
+
+        rebalancer.rounds++;
+        rebalancer.moved += moved;
+
+        std::cout << "Rebalancing: loop " << busiest << " (" << shares[busiest] << "% busy) -> loop " << idlest <<
+                  " (" << shares[idlest] << "% busy), moved " << moved << " connections" << std::endl;
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include<atomic>
+#include<cstdint>
+#include<vector>
+
+namespace worker::server {
+    struct State;
+
+    struct Rebalancer {
+        // Busy time of each loop at the last check (us)
+        std::vector<uint64_t> busy_sampled;
+
+        // Rebalancing rounds and connections moved so far
+        std::atomic<uint64_t> rounds;
+        std::atomic<uint64_t> moved;
+    };
+
+    // Compare how busy the loops were since the last check and, past the imbalance threshold, move the busiest
+    // connections (or channels, placement by channel) from the busiest loop to the idlest one. Runs periodically on
+    // the first loop.
+    void rebalance_check(State *state);
+}
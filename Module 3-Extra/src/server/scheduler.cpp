@@ -0,0 +1,192 @@
+#include<latch>
+#include<random>
+
+#include "../common/affinity.h"
+#include "../common/config.h"
+
+#include "scheduler.h"
+
+namespace worker::server {
+    // Worker identity of the current thread
+    static thread_local Scheduler *local_scheduler = nullptr;
+    static thread_local size_t local_index = 0;
+    static thread_local std::minstd_rand local_random;
+
+    // Rounds of failed steal attempts before a worker parks
+    static const int STEAL_ROUNDS = 4;
+
+    /////////////////
+    // Task Queues //
+    /////////////////
+
+    static bool pop_local(Scheduler *scheduler, Task &task) {
+        TaskDeque &deque = *scheduler->deques[local_index];
+        auto guard = std::lock_guard<std::mutex>(deque.mutex);
+
+        if (deque.tasks.empty()) {
+            return false;
+        }
+
+        task = std::move(deque.tasks.back());
+        deque.tasks.pop_back();
+        scheduler->queued--;
+        return true;
+    }
+
+    static bool steal(Scheduler *scheduler, Task &task) {
+        size_t count = scheduler->deques.size();
+        size_t start = local_random() % count;
+
+        // Visit every victim once, starting from a random one
+        for (size_t i = 0; i < count; i++) {
+            size_t victim = (start + i) % count;
+            if (victim == local_index) {
+                continue;
+            }
+
+            TaskDeque &deque = *scheduler->deques[victim];
+            auto guard = std::lock_guard<std::mutex>(deque.mutex);
+
+            if (deque.tasks.empty()) {
+                continue;
+            }
+
+            task = std::move(deque.tasks.front());
+            deque.tasks.pop_front();
+            scheduler->queued--;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Run a single pending task, if any is found
+    static bool run_one(Scheduler *scheduler) {
+        Task task;
+
+        if (!pop_local(scheduler, task) && !steal(scheduler, task)) {
+            return false;
+        }
+
+        task();
+        return true;
+    }
+
+    //////////////////////
+    // Worker Lifecycle //
+    //////////////////////
+
+    static void worker(Scheduler *scheduler, size_t index) {
+        local_scheduler = scheduler;
+        local_index = index;
+        local_random.seed(index + 1);
+
+        while (!scheduler->stopping) {
+            bool ran = false;
+            for (int i = 0; i < STEAL_ROUNDS && !ran; i++) {
+                ran = run_one(scheduler);
+            }
+
+            if (ran) {
+                continue;
+            }
+
+            // Nothing to run, park until new work is spawned (or the periodic stop check)
+            auto lock = std::unique_lock<std::mutex>(scheduler->idle_mutex);
+            scheduler->idle.wait_for(lock, config::QUEUE_WAIT_INTERVAL, [scheduler]() {
+                return scheduler->queued > 0 || scheduler->stopping;
+            });
+        }
+
+        local_scheduler = nullptr;
+    }
+
+    void scheduler_start(Scheduler *scheduler, unsigned int threads, const std::vector<int> &cpus) {
+        scheduler->stopping = false;
+        scheduler->queued = 0;
+        scheduler->next_deque = 0;
+        scheduler->cpus = cpus;
+
+        // Every deque is created by its worker, once pinned, so it lives on the worker's NUMA node (first touch)
+        scheduler->deques.resize(threads);
+        auto created = std::make_shared<std::latch>(threads + 1);
+
+        for (unsigned int i = 0; i < threads; i++) {
+            scheduler->workers.emplace_back([scheduler, i, created]() {
+                affinity::pin_thread(affinity::pool_cpus(scheduler->cpus, i));
+                scheduler->deques[i] = std::make_unique<TaskDeque>();
+
+                // Only run after every deque is in place, workers steal from each other
+                created->arrive_and_wait();
+                worker(scheduler, i);
+            });
+        }
+
+        created->arrive_and_wait();
+    }
+
+    void scheduler_stop(Scheduler *scheduler) {
+        {
+            auto guard = std::lock_guard<std::mutex>(scheduler->idle_mutex);
+            scheduler->stopping = true;
+        }
+        scheduler->idle.notify_all();
+
+        for (auto &thread: scheduler->workers) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+
+        scheduler->workers.clear();
+        scheduler->deques.clear();
+    }
+
+    Scheduler *current_scheduler() {
+        return local_scheduler;
+    }
+
+    /////////////////////
+    // Task Submission //
+    /////////////////////
+
+    void spawn(Scheduler *scheduler, Task &&task) {
+        // Workers keep their own tasks local, other threads spread them round-robin
+        size_t index = local_scheduler == scheduler
+                       ? local_index
+                       : scheduler->next_deque++ % scheduler->deques.size();
+
+        {
+            TaskDeque &deque = *scheduler->deques[index];
+            auto guard = std::lock_guard<std::mutex>(deque.mutex);
+            deque.tasks.push_back(std::move(task));
+            scheduler->queued++;
+        }
+
+        // Wake a parked worker, the lock ensures the wake-up isn't lost between its check and its wait
+        {
+            auto guard = std::lock_guard<std::mutex>(scheduler->idle_mutex);
+        }
+        scheduler->idle.notify_one();
+    }
+
+    void spawn(Scheduler *scheduler, TaskGroup &group, Task &&task) {
+        group.pending++;
+
+        spawn(scheduler, [&group, task = std::move(task)]() {
+            task();
+            group.pending--;
+        });
+    }
+
+    void wait(Scheduler *scheduler, TaskGroup &group) {
+        while (group.pending > 0) {
+            // Help with pending work (likely our own chunks) instead of blocking the worker
+            if (local_scheduler == scheduler && run_one(scheduler)) {
+                continue;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include<atomic>
+#include<condition_variable>
+#include<deque>
+#include<functional>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+namespace worker::server {
+    typedef std::function<void()> Task;
+
+    // Tasks owned by a single worker. The owner pushes/pops at the back (LIFO, cache friendly), thieves take from
+    // the front (oldest, usually the biggest chunk of remaining work).
+    struct TaskDeque {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Tracks a set of spawned tasks so the spawner can wait for all of them (fork/join)
+    struct TaskGroup {
+        std::atomic<size_t> pending{0};
+    };
+
+    // Work-stealing scheduler: each worker thread has its own deque and, when it runs dry, steals from a random
+    // victim. Tasks spawned from outside the pool are spread over the deques.
+    struct Scheduler {
+        std::atomic<bool> stopping;
+
+        std::vector<std::unique_ptr<TaskDeque> > deques;
+        std::vector<std::thread> workers;
+
+        // CPUs the workers are spread over (empty if they aren't pinned)
+        std::vector<int> cpus;
+
+        // Tasks currently sitting in any deque (used to park/wake idle workers)
+        std::atomic<size_t> queued;
+        std::atomic<size_t> next_deque;
+
+        std::mutex idle_mutex;
+        std::condition_variable idle;
+    };
+
+    void scheduler_start(Scheduler *scheduler, unsigned int threads, const std::vector<int> &cpus);
+
+    void scheduler_stop(Scheduler *scheduler);
+
+    // Scheduler of the calling thread (nullptr if it isn't a worker thread)
+    Scheduler *current_scheduler();
+
+    void spawn(Scheduler *scheduler, Task &&task);
+
+    void spawn(Scheduler *scheduler, TaskGroup &group, Task &&task);
+
+    // Wait until every task of the group finished, running pending tasks in the meantime
+    void wait(Scheduler *scheduler, TaskGroup &group);
+}
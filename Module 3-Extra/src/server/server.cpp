@@ -1,7 +1,11 @@
 #include<iostream>
 #include<thread>
 #include<csignal>
+#include<sys/epoll.h>
+#include<sys/mman.h>
+#include<unistd.h>
 
+#include "../common/affinity.h"
 #include "../common/config.h"
 #include "../common/error.h"
 #include "../common/network.h"
@@ -10,9 +14,20 @@
 
 static worker::server::State state = {
         .socket_fd = -1,
+        .accept_fd = -1,
         .kill = false,
 };
 
+// Ask for the rate limits to be reloaded
+static void reload_handler(int sig) {
+    state.reload = true;
+}
+
+// Ask for the overload metrics to be printed
+static void report_handler(int sig) {
+    state.overload.report = true;
+}
+
 // Handle signals
 static void sig_handler(int sig) {
     std::cout << "\rInterrupting server..." << std::endl;
@@ -28,8 +43,14 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (std::signal(SIGHUP, reload_handler) == SIG_ERR || std::signal(SIGUSR1, report_handler) == SIG_ERR) {
+        error::error("Failed to register signal handler");
+        return 1;
+    }
+
     // Load host & port config from the command line
     config::ConnectionConfig config = config::parse_config(argc, argv);
+    config::ServerConfig server_config = config::parse_server_config(argc, argv);
 
     // Spin-up new server using the given configuration
     int socket_fd = network::listen(config);
@@ -40,15 +61,120 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // Options of the accepted connections, set once on the listener (they inherit them)
+    if (network::configure_keepalive(socket_fd, server_config.keepalive) != 0) {
+        return 1;
+    }
+    if (server_config.defer_accept > 0 && network::configure_defer_accept(socket_fd, server_config.defer_accept) != 0) {
+        return 1;
+    }
+    const config::SocketTuning *tuning = worker::server::initial_tuning(server_config.socket_profile);
+    if (tuning != nullptr && network::configure_tuning(socket_fd, *tuning) != 0) {
+        return 1;
+    }
+    if (server_config.zerocopy > 0 && !network::configure_zerocopy(socket_fd)) {
+        server_config.zerocopy = 0;
+    }
+
+    // Same-host clients skip the TCP stack, the TCP options above don't apply to them
+    for (const auto &path: config.unix_paths) {
+        int local_fd = network::listen_unix(path);
+        if (local_fd == -1) {
+            std::cout << "Failed to bind " << path << std::endl;
+            return 1;
+        }
+        state.local_fds.push_back(local_fd);
+    }
+
+    // With several listeners, the acceptor sleeps on an epoll set of all of them
+    state.accept_fd = socket_fd;
+    if (!state.local_fds.empty()) {
+        state.accept_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (state.accept_fd < 0) {
+            error::error("Failed to create the listeners epoll set!");
+            return 1;
+        }
+
+        for (int listener_fd: state.local_fds) {
+            epoll_event event = {.events = EPOLLIN, .data = {.fd = listener_fd}};
+            epoll_ctl(state.accept_fd, EPOLL_CTL_ADD, listener_fd, &event);
+        }
+        epoll_event event = {.events = EPOLLIN, .data = {.fd = socket_fd}};
+        epoll_ctl(state.accept_fd, EPOLL_CTL_ADD, socket_fd, &event);
+    }
+
+    state.config = server_config;
+    worker::server::rate_limits_set(&state.rate_limits, server_config.rate_limits);
+
+    // Spin-up the event loops serving the client connections
+    worker::server::loops_start(&state, server_config.io_threads);
+
+    // Sweep dead clients periodically (on the first loop)
+    worker::server::post_after(state.loops[0].get(), config::REAP_INTERVAL, [] { worker::server::reaper(&state); });
+
+    // Watch for overload (on the first loop too)
+    worker::server::post_after(state.loops[0].get(), config::OVERLOAD_INTERVAL,
+                               [] { worker::server::overload_check(&state); });
+
+    // Even out the loads of the event loops (on the first loop too)
+    if (server_config.rebalance_threshold > 0 && server_config.io_threads > 1) {
+        worker::server::post_after(state.loops[0].get(), config::REBALANCE_INTERVAL,
+                                   [] { worker::server::rebalance_check(&state); });
+    }
+
+    // Adapt the socket settings of the connections to their traffic (on every loop, each checks its own connections)
+    if (server_config.socket_profile == config::SocketProfile::ADAPTIVE) {
+        for (const auto &loop: state.loops) {
+            worker::server::post_after(loop.get(), config::TUNING_INTERVAL,
+                                       [loop = loop.get()] { worker::server::tuning_check(loop, &state); });
+        }
+    }
+
+    // Spin-up the handler threads (pipeline mode), if enabled
+    worker::server::pipeline_start(&state, server_config.handler_threads, server_config.handler_queue_capacity);
+
+    // Busy-poll mode: keep the hot state (already touched by the loops and handlers above) resident, so a page fault
+    // never stalls the polling threads. Pages are locked as they fault in, locking every thread stack up-front would
+    // blow RLIMIT_MEMLOCK.
+    if (server_config.busy_poll > 0) {
+#ifdef MCL_ONFAULT
+        int flags = MCL_CURRENT | MCL_ONFAULT;
+#else
+        int flags = MCL_CURRENT;
+#endif
+        if (mlockall(flags) != 0) {
+            error::warning("Failed to lock memory (RLIMIT_MEMLOCK?), page faults may add latency!");
+        }
+    }
+
+    // Report where the threads run
+    affinity::report_topology();
+    affinity::report_placement("acceptor", server_config.affinity.acceptor, 1, true);
+    affinity::report_placement("io", server_config.affinity.io, server_config.io_threads, false);
+    affinity::report_placement("handler", server_config.affinity.handler, server_config.handler_threads, false);
+
     // Initiate manager thread and join it
     std::thread manager_thread(worker::server::manager, &state);
     manager_thread.join();
 
+    // Wait for the event loops to close every connection, then stop the handler threads
+    worker::server::loops_stop(&state);
+    worker::server::pipeline_stop(&state);
+
     // Release socket
     if (state.socket_fd != -1) {
         close(state.socket_fd);
     }
 
+    // And the Unix domain sockets, along with their files
+    for (size_t i = 0; i < state.local_fds.size(); i++) {
+        close(state.local_fds[i]);
+        unlink(config.unix_paths[i].c_str());
+    }
+    if (state.accept_fd != state.socket_fd) {
+        close(state.accept_fd);
+    }
+
     std::cout << "\r\nServer interrupted" << std::endl;
 
     return 0;
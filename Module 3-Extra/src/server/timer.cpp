@@ -0,0 +1,176 @@
+#include "timer.h"
+
+namespace worker::server {
+
+    ////////////////
+    // Slot Lists //
+    ////////////////
+
+    static void list_init(Timer *head) {
+        head->prev = head;
+        head->next = head;
+    }
+
+    static bool list_empty(const Timer *head) {
+        return head->next == head;
+    }
+
+    static void list_append(Timer *head, Timer *timer) {
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+
+    static void list_unlink(Timer *timer) {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = nullptr;
+        timer->next = nullptr;
+    }
+
+    // Move every timer of a list into another (empty) one
+    static void list_take(Timer *from, Timer *to) {
+        if (list_empty(from)) {
+            return;
+        }
+
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        list_init(from);
+    }
+
+    //////////////////
+    // Timing Wheel //
+    //////////////////
+
+    // Pick the slot for a timer, based on how far in the future it expires
+    static void place(TimingWheel *wheel, Timer *timer) {
+        // Already expired, run on the next tick
+        if (timer->expires < wheel->now) {
+            list_append(&wheel->slots[0][wheel->now & WHEEL_MASK], timer);
+            return;
+        }
+
+        uint64_t delta = timer->expires - wheel->now;
+
+        for (int level = 0; level < WHEEL_LEVELS; level++) {
+            if (delta < (WHEEL_SLOTS << (WHEEL_BITS * level)) || level == WHEEL_LEVELS - 1) {
+                // Clamp delays beyond the wheel range to the furthest slot
+                uint64_t max_delta = (WHEEL_SLOTS << (WHEEL_BITS * level)) - 1;
+                if (delta > max_delta) {
+                    timer->expires = wheel->now + max_delta;
+                }
+
+                uint64_t slot = (timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+                list_append(&wheel->slots[level][slot], timer);
+                return;
+            }
+        }
+    }
+
+    // Re-place every timer of a coarse slot, spreading them over the finer levels. Returns the slot index.
+    static uint64_t cascade(TimingWheel *wheel, int level) {
+        uint64_t slot = (wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+        Timer pending;
+        list_init(&pending);
+        list_take(&wheel->slots[level][slot], &pending);
+
+        while (!list_empty(&pending)) {
+            Timer *timer = pending.next;
+            list_unlink(timer);
+            place(wheel, timer);
+        }
+
+        return slot;
+    }
+
+    void wheel_init(TimingWheel *wheel) {
+        wheel->now = 0;
+        wheel->armed = 0;
+
+        for (auto &level: wheel->slots) {
+            for (auto &slot: level) {
+                list_init(&slot);
+            }
+        }
+    }
+
+    void wheel_advance(TimingWheel *wheel, uint64_t tick) {
+        while (wheel->now <= tick) {
+            uint64_t slot = wheel->now & WHEEL_MASK;
+
+            // The finest level wrapped around, pull down the timers of the next coarser slot (and so on)
+            if (slot == 0) {
+                for (int level = 1; level < WHEEL_LEVELS && cascade(wheel, level) == 0; level++) {}
+            }
+
+            wheel->now++;
+
+            Timer expired;
+            list_init(&expired);
+            list_take(&wheel->slots[0][slot], &expired);
+
+            // Timers are unlinked one by one, so callbacks may freely cancel or re-arm any other timer
+            while (!list_empty(&expired)) {
+                Timer *timer = expired.next;
+                list_unlink(timer);
+                wheel->armed--;
+
+                if (timer->owned) {
+                    std::function<void()> callback = std::move(timer->callback);
+                    delete timer;
+                    callback();
+                } else {
+                    timer->callback();
+                }
+            }
+        }
+    }
+
+    void wheel_clear(TimingWheel *wheel) {
+        for (auto &level: wheel->slots) {
+            for (auto &slot: level) {
+                while (!list_empty(&slot)) {
+                    Timer *timer = slot.next;
+                    list_unlink(timer);
+
+                    if (timer->owned) {
+                        delete timer;
+                    }
+                }
+            }
+        }
+
+        wheel->armed = 0;
+    }
+
+    ////////////
+    // Timers //
+    ////////////
+
+    void timer_schedule(TimingWheel *wheel, Timer *timer, uint64_t ticks) {
+        timer_cancel(wheel, timer);
+
+        // Expiring "now" means the next processed tick, never the one being processed
+        timer->expires = wheel->now + ticks;
+        place(wheel, timer);
+        wheel->armed++;
+    }
+
+    void timer_cancel(TimingWheel *wheel, Timer *timer) {
+        if (!timer_armed(timer)) {
+            return;
+        }
+
+        list_unlink(timer);
+        wheel->armed--;
+    }
+
+    bool timer_armed(const Timer *timer) {
+        return timer->next != nullptr;
+    }
+}
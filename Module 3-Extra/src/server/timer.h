@@ -0,0 +1,53 @@
+#pragma once
+
+#include<cstdint>
+#include<functional>
+
+namespace worker::server {
+    // Wheel geometry: 4 levels of 64 slots, each level 64 times coarser than the previous one
+    static const int WHEEL_LEVELS = 4;
+    static const int WHEEL_BITS = 6;
+    static const uint64_t WHEEL_SLOTS = 1 << WHEEL_BITS;
+    static const uint64_t WHEEL_MASK = WHEEL_SLOTS - 1;
+
+    // Timer entry, linked into a wheel slot while armed (intrusive, so arming and cancelling are O(1))
+    struct Timer {
+        Timer *prev = nullptr;
+        Timer *next = nullptr;
+
+        // Tick in which the timer expires
+        uint64_t expires = 0;
+
+        std::function<void()> callback;
+
+        // Allocated by the wheel itself (one-shot work), released once it fires
+        bool owned = false;
+    };
+
+    // Hierarchical timing wheel. Timers far in the future sit on the coarser levels and cascade down as the wheel
+    // turns. Not thread-safe, each event loop owns one.
+    struct TimingWheel {
+        // Next tick to be processed
+        uint64_t now;
+        // Armed timers
+        size_t armed;
+
+        // Slot list heads (circular, the head itself is a sentinel)
+        Timer slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    };
+
+    void wheel_init(TimingWheel *wheel);
+
+    // Run every timer that expired up to the given tick
+    void wheel_advance(TimingWheel *wheel, uint64_t tick);
+
+    // Cancel every armed timer, releasing the owned ones
+    void wheel_clear(TimingWheel *wheel);
+
+    // Arm (or re-arm) a timer to expire in the given number of ticks
+    void timer_schedule(TimingWheel *wheel, Timer *timer, uint64_t ticks);
+
+    void timer_cancel(TimingWheel *wheel, Timer *timer);
+
+    bool timer_armed(const Timer *timer);
+}
@@ -0,0 +1,55 @@
+#include "../common/network.h"
+
+#include "worker.h"
+#include "tuning.h"
+
+namespace worker::server {
+    const config::SocketTuning *initial_tuning(config::SocketProfile profile) {
+        switch (profile) {
+            case config::SocketProfile::LATENCY:
+            case config::SocketProfile::ADAPTIVE:
+                return &config::LATENCY_TUNING;
+
+            case config::SocketProfile::THROUGHPUT:
+                return &config::THROUGHPUT_TUNING;
+
+            default:
+                return nullptr;
+        }
+    }
+
+    void tuning_check(EventLoop *loop, State *state) {
+        uint64_t interval = std::chrono::duration_cast<std::chrono::milliseconds>(config::TUNING_INTERVAL).count();
+        uint64_t bulk_bytes = config::ADAPTIVE_BULK_RATE * interval / 1000;
+
+        for (const auto &client_ptr: loop->clients) {
+            IoState &io = client_ptr->io;
+            uint64_t sent = io.sent_bytes - io.sent_sampled;
+            io.sent_sampled = io.sent_bytes;
+
+            // (Unix domain sockets have no TCP settings to switch)
+            if (client_ptr->connection.socket_fd < 0 || client_ptr->connection.client_address.sin_family == AF_UNIX) {
+                continue;
+            }
+
+            // Some hysteresis, so a connection around the threshold isn't switched back and forth
+            bool bulk = io.bulk ? sent >= bulk_bytes / 4 : sent > bulk_bytes;
+            if (bulk == io.bulk) {
+                continue;
+            }
+
+            // Going back to the latency settings keeps the (fixed) big buffers, the unsent limit is what keeps the
+            // kernel backlog short
+            const config::SocketTuning &tuning = bulk ? config::THROUGHPUT_TUNING : config::LATENCY_TUNING;
+            if (network::configure_tuning(client_ptr->connection.socket_fd, tuning) != 0) {
+                continue;
+            }
+
+            io.bulk = bulk;
+            io.cork = tuning.cork;
+            (bulk ? loop->retuned_bulk : loop->retuned_latency)++;
+        }
+
+        post_after(loop, config::TUNING_INTERVAL, [loop, state]() { tuning_check(loop, state); });
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "../common/config.h"
+
+namespace worker::server {
+    struct State;
+    struct EventLoop;
+
+    // Socket settings the connections of a profile start with (nullptr keeps the kernel defaults)
+    const config::SocketTuning *initial_tuning(config::SocketProfile profile);
+
+    // Adaptive profile: switch the loop connections between the latency and throughput settings following how much they
+    // were sent since the last check. Runs periodically on each loop.
+    void tuning_check(EventLoop *loop, State *state);
+}
@@ -1,13 +1,17 @@
+#include<algorithm>
 #include<iomanip>
 #include<iostream>
 #include<map>
 #include<mutex>
 #include<memory>
 #include<thread>
+#include<vector>
 
 #include<strings.h>
 
+#include "../common/affinity.h"
 #include "../common/error.h"
+#include "../common/wait.h"
 
 #include "worker.h"
 
@@ -17,100 +21,131 @@ namespace worker::server {
     // Connection Management //
     ///////////////////////////
 
-    std::shared_ptr<Client> accept_client(State *state) {
-        // Accept a new connection on the server listener socket. Since the call is non-blocking, it will likely result
-        // in a EAGAIN or EWOULDBLOCK error, which is mapped as conn.socket_fd = -2. In those cases, we should retry
-        // accepting a connection after a small delay.
-        //
-        // The implementation here ensures that a delay will only be triggered if there is no pending connections.
-        network::Connection conn = network::accept_conn(state->socket_fd);
-
-        // If there is no available pending connection, try again after a small delay
-        while (conn.socket_fd == -2 && !state->kill) {
-            // Delay the retry for the configured interval
-            std::this_thread::sleep_for(config::POLLING_INTERVAL);
-            // Retry to get a new connection
-            conn = network::accept_conn(state->socket_fd);
+    // While the server is overloaded, new connections are refused rather than making everyone else wait longer. The
+    // refused connection is closed and reported as no connection at all (-2).
+    static bool refuse_if_overloaded(network::Connection &conn, State *state) {
+        if (conn.socket_fd < 0 || state->overload.level < REFUSING) {
+            return false;
         }
 
-        // A kill signal was triggered, cleanup and exit
-        if (state->kill) {
-            // If for the unluckiest of odds, the application was killed at the same time a new connection was received
-            // properly finish it
-            if (conn.socket_fd >= 0) {
-                close(conn.socket_fd);
-            }
-
-            return nullptr;
-        }
+        std::string busy = "Server is overloaded, try again later";
+        send(conn.socket_fd, busy.data(), busy.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(conn.socket_fd);
+        conn.socket_fd = -2;
 
-        // There was an error while creation the connection, most likely irrecoverable
-        // Log that an error happened and signal it (through the nullptr response) to the thread handler.
-        if (conn.socket_fd == -1) {
-            error::error("Connection failed!");
-            return nullptr;
-        }
+        state->overload.refused_connections++;
+        return true;
+    }
 
+    static std::shared_ptr<Client> make_client(const network::Connection &conn, State *state) {
         // Build new client using a shared pointer (easier to manage memory)
         std::shared_ptr<Client> client_ptr = std::make_shared<Client>();
+        client_ptr->id = state->next_client_id++; // Unique id, also used to pick the client's handler queue
         client_ptr->connection = conn; // Client's connection data, include the socket fd
         client_ptr->ip_str = network::address_repr(conn.client_address); // Parse the client IP into a string
         client_ptr->nickname = nullptr; // The client starts without an assigned nickname
         client_ptr->alive = true; // If the client is alive and happy :)
+        client_ptr->outbound.limits = state->config.outbound; // Outbound queue limits
+        client_ptr->outbound.total_bytes = &state->overload.outbound_bytes; // Server wide outbound bytes
+        client_ptr->io.zerocopy = state->config.zerocopy; // Big messages are sent without copying them (if enabled)
+        client_ptr->io.cork = state->config.socket_profile == config::SocketProfile::THROUGHPUT; // Full segments
+
+        // Unix domain sockets copy straight into the peer, there are no segments nor zero-copy completions
+        if (conn.client_address.sin_family == AF_UNIX) {
+            client_ptr->io.zerocopy = 0;
+            client_ptr->io.cork = false;
+        }
 
         // Return the shared pointer
         return client_ptr;
     }
 
+    // Accept every connection waiting on the listener (up to config::ACCEPT_BATCH of them), so a burst of connections
+    // costs a single wake-up of the acceptor. The listener is non-blocking, once its backlog is drained the accept
+    // results in a EAGAIN or EWOULDBLOCK error (mapped as conn.socket_fd = -2). Returns false on errors, most likely
+    // irrecoverable.
+    static bool accept_clients(State *state, int listener_fd, std::vector<std::shared_ptr<Client> > &accepted) {
+        while (accepted.size() < config::ACCEPT_BATCH && !state->kill) {
+            network::Connection conn = network::accept_conn(listener_fd);
+
+            // Backlog drained
+            if (conn.socket_fd == -2) {
+                break;
+            }
+
+            if (conn.socket_fd == -1) {
+                error::error("Connection failed!");
+                return false;
+            }
+
+            // (more connections may be waiting behind a refused one)
+            if (refuse_if_overloaded(conn, state)) {
+                continue;
+            }
+
+            accepted.push_back(make_client(conn, state));
+        }
+
+        return true;
+    }
+
     void manager(State *state) {
         // If no state, exit
         if (state == nullptr) {
             return;
         }
 
-        // Client threads (for later joining)
-        std::map<std::shared_ptr<worker::server::Client>, std::thread> threads;
+        // Keep the acceptor on its CPUs
+        affinity::pin_thread(state->config.affinity.acceptor);
+
+        // Waits for new connections in between batches (spinning at first, then backing off)
+        wait::Waiter waiter = wait::waiter_for(state->config.wait_profile, false);
+        std::vector<std::shared_ptr<Client> > accepted;
 
         // While the application should be alive, accept new clients
         while (!state->kill) {
+            accepted.clear();
 
-            // Try accepting a new client
-            std::shared_ptr<Client> client_ptr = accept_client(state);
+            // Try accepting the new clients, on every listener (sharing the batch)
+            bool ok = accept_clients(state, state->socket_fd, accepted);
+            for (int local_fd: state->local_fds) {
+                ok = ok && accept_clients(state, local_fd, accepted);
+            }
 
-            // Check if a new client was successfully accepted
-            if (!client_ptr) {
+            if (!ok) {
                 // Most errors of this kind aren't recoverable, so we'll trigger a kill here
                 state->kill = true;
+            }
+
+            // A kill signal was triggered, cleanup and exit. If for the unluckiest of odds, the application was killed
+            // while new connections were received, properly finish them.
+            if (state->kill) {
+                for (const auto &client_ptr: accepted) {
+                    close(client_ptr->connection.socket_fd);
+                }
                 break;
             }
 
-            std::cout << "New client from " << client_ptr->ip_str << std::endl;
+            // Nothing waiting, sleep until the listener is readable again
+            if (accepted.empty()) {
+                wait::idle(waiter, state->accept_fd);
+                continue;
+            }
+            wait::reset(waiter);
 
-            // We have a new connection, register it to the clients map. Here we do guarded access to the map to avoid
+            // We have new connections, register them to the clients map. Here we do guarded access to the map to avoid
             // any concurrency issues. The guard is destroyed after leaving the context, releasing the lock.
             {
                 auto guard = std::lock_guard<std::mutex>(state->clients_mutex);
-                state->clients.insert(client_ptr);
-
-                // Cleanup dead clients
-                auto it = state->clients.begin();
-                while (it != state->clients.end()) {
-                    if ((*it)->alive) {
-                        it++;
-                        continue;
-                    }
-
-                    // Detach thread to avoid a thread leak
-                    threads[(*it)].detach();
-                    threads.erase((*it));
-
-                    // Remove client from tracking list
-                    it = state->clients.erase(it);
-                }
+                state->clients.insert(accepted.begin(), accepted.end());
             }
 
-            // Add the thread to the tracking map
-            threads.emplace(client_ptr, std::thread(communicator, client_ptr, state));
+            for (const auto &client_ptr: accepted) {
+                std::cout << "New client from " << client_ptr->ip_str << std::endl;
+
+                // Hand the connection over to one of the event loops
+                attach(state->loops[client_ptr->id % state->loops.size()].get(), client_ptr, state);
+            }
         }
 
         // The only we should reach here is if a kill signal was received, but let's ensure it anyway to prevent future
@@ -119,166 +154,501 @@ namespace worker::server {
             state->kill = true;
         }
 
-        // Wait for each communicator thread to die :)
-        for (auto &entry: threads) {
-            if (entry.second.joinable()) {
-                entry.second.join();
+        // The event loops close the remaining connections on their own
+    }
+
+    void reaper(State *state) {
+        // Apply a requested reload of the rate limits (SIGHUP), invalid files keep the current limits
+        if (state->reload.exchange(false) && !state->config.rate_limits_file.empty()) {
+            config::RateLimitConfig limits = state->config.rate_limits;
+
+            if (config::load_rate_limits(state->config.rate_limits_file, limits)) {
+                state->config.rate_limits = limits;
+                rate_limits_set(&state->rate_limits, limits);
+                std::cout << "Rate limits reloaded from " << state->config.rate_limits_file << std::endl;
+            } else {
+                error::warning("Failed to reload the rate limits, keeping the current ones");
             }
         }
-    }
 
-    void communicator(const std::shared_ptr<Client> &client_ptr, State *state) {
-        // Create a message buffer for receiving the client's messages. The +1 is to simplify conversion into a valid,
-        // null-terminated, C-string :)
-        char buffer[config::MAX_MESSAGE_SIZE + 1];
+        // Drop dead clients from the server tables, periodically
+        {
+            auto guard = std::lock_guard<std::mutex>(state->clients_mutex);
 
-        // Check for new messages from the client while the application and client are alive
-        while (!state->kill && client_ptr->alive) {
-            // Send pending messages on the queue
-            if (communicator_outgoing(client_ptr, state)) {
-                break;
+            auto it = state->clients.begin();
+            while (it != state->clients.end()) {
+                if ((*it)->alive) {
+                    it++;
+                    continue;
+                }
+
+                // Remove client from tracking list
+                it = state->clients.erase(it);
             }
+        }
 
-            // Read new command, if available
-            if (communicator_incoming(client_ptr, state, buffer)) {
-                break;
+        // Release the nicknames of dead clients
+        {
+            auto guard = std::lock_guard<std::mutex>(state->registered_clients_mutex);
+
+            auto it = state->registered_clients.begin();
+            while (it != state->registered_clients.end()) {
+                if (it->second->alive) {
+                    it++;
+                    continue;
+                }
+
+                it = state->registered_clients.erase(it);
             }
         }
 
-        // There is only two scenarios here: either our connection is dead or the application is being killed
-        if (client_ptr->alive) {
+        // Remove dead members from the channels. The channels are copied first, a channel lock must never be
+        // acquired while holding the channels lock (handle_join acquires them in the opposite order).
+        std::vector<std::shared_ptr<Channel> > channels;
+        {
+            auto guard = std::lock_guard<std::mutex>(state->channels_mutex);
+            for (const auto &entry: state->channels) {
+                channels.push_back(entry.second);
+            }
+        }
+
+        for (const auto &channel: channels) {
+            auto guard = std::lock_guard<std::mutex>(channel->mutex);
+
+            auto it = channel->members.begin();
+            while (it != channel->members.end()) {
+                if ((*it)->alive) {
+                    it++;
+                    continue;
+                }
+
+                it = channel->members.erase(it);
+            }
+
+            // If channel is empty, kill it
+            if (channel->members.empty()) {
+                auto guard2 = std::lock_guard<std::mutex>(state->channels_mutex);
+
+                auto channel_it = state->channels.find(channel->name);
+                if (channel_it != state->channels.end() && channel_it->second == channel) {
+                    state->channels.erase(channel_it);
+                }
+            }
+        }
+
+        // Schedule the next sweep
+        post_after(state->loops[0].get(), config::REAP_INTERVAL, [state]() { reaper(state); });
+    }
+
+    static void check_idle(const std::shared_ptr<Client> &client_ptr, State *state) {
+        if (!client_ptr->alive) {
+            return;
+        }
+
+        IoState &io = client_ptr->io;
+        uint64_t now = now_ms();
+        auto silent = std::chrono::milliseconds(now - io.last_activity);
+
+        auto idle_timeout = std::chrono::duration_cast<std::chrono::milliseconds>(state->config.idle_timeout);
+        auto ping_interval = std::chrono::duration_cast<std::chrono::milliseconds>(state->config.ping_interval);
+        auto ping_timeout = std::chrono::duration_cast<std::chrono::milliseconds>(state->config.ping_timeout);
+
+        // The client has been silent for too long, consider it dead
+        if (idle_timeout.count() > 0 && silent >= idle_timeout) {
+            error::warning("The client with ip " + client_ptr->ip_str + " timed out!");
             client_ptr->alive = false;
+            wake_reader(client_ptr);
+            return;
+        }
+
+        // The ping wasn't answered in time. If the peer TCP still acknowledged something since it was sent (a client
+        // that doesn't answer pings, or a ping stuck behind a backlog of messages) the peer is alive, otherwise the
+        // connection is likely half-open (peer gone without closing it).
+        auto unanswered = std::chrono::milliseconds(io.pinged_at != 0 ? now - io.pinged_at : 0);
+        if (io.pinged_at != 0 && ping_timeout.count() > 0 && unanswered >= ping_timeout) {
+            if (!network::acked_within(client_ptr->connection.socket_fd, unanswered)) {
+                error::warning("The client with ip " + client_ptr->ip_str + " missed its keepalive!");
+                client_ptr->alive = false;
+                wake_reader(client_ptr);
+                return;
+            }
+
+            io.pinged_at = 0;
+            io.acked_at = now;
         }
 
-        // Close connection socket, if not already closed
-        if (client_ptr->connection.socket_fd >= 0) {
-            close(client_ptr->connection.socket_fd);
-            client_ptr->connection.socket_fd = -1;
+        // Ask for a sign of life (any frame, usually the client automatic pong) once neither frames nor
+        // acknowledgements came for a while
+        auto quiet = std::chrono::milliseconds(now - std::max(io.last_activity, io.acked_at));
+        if (ping_interval.count() > 0 && io.pinged_at == 0 && quiet >= ping_interval) {
+            io.pinged_at = now;
+            unanswered = std::chrono::milliseconds(0);
+            client_ptr->add_message(std::make_shared<std::string>(config::PING_MESSAGE));
+        }
+
+        // Check again at the closest deadline
+        std::chrono::milliseconds next = std::chrono::hours(1);
+        if (idle_timeout.count() > 0) {
+            next = std::min(next, idle_timeout - silent);
+        }
+        if (ping_interval.count() > 0 && io.pinged_at == 0) {
+            next = std::min(next, ping_interval - quiet);
+        }
+        if (ping_timeout.count() > 0 && io.pinged_at != 0) {
+            next = std::min(next, ping_timeout - unanswered);
+        }
+
+        loop_timer(io.loop, &io.idle_timer, next);
+    }
+
+    void teardown(const std::shared_ptr<Client> &client_ptr, State *state) {
+        // Nothing will ever be sent, release the pending messages
+        client_ptr->outbound.clear();
+
+        if (client_ptr->outbound.dropped_messages > 0) {
+            error::warning("The client with ip " + client_ptr->ip_str + " had " +
+                           std::to_string(client_ptr->outbound.dropped_messages) + " messages (" +
+                           std::to_string(client_ptr->outbound.dropped_bytes) + " bytes) dropped");
+        }
+
+        if (client_ptr->lagged > 0) {
+            error::warning("The client with ip " + client_ptr->ip_str + " lagged behind its channels by " +
+                           std::to_string(client_ptr->lagged) + " messages");
+        }
+
+        {
+            auto guard = std::lock_guard<std::mutex>(client_ptr->cursor_mutex);
+            client_ptr->log = nullptr;
+        }
+
+        if (client_ptr->throttled_lines > 0) {
+            error::warning("The client with ip " + client_ptr->ip_str + " was throttled on " +
+                           std::to_string(client_ptr->throttled_lines) + " lines");
+        }
+
+        // Leave the channel right away, so broadcasts stop targeting the client
+        std::shared_ptr<Channel> channel = client_ptr->channel;
+        if (channel) {
+            auto guard = std::lock_guard<std::mutex>(channel->mutex);
+            channel->members.erase(client_ptr);
+
+            // If channel is empty, kill it
+            if (channel->members.empty()) {
+                auto guard2 = std::lock_guard<std::mutex>(state->channels_mutex);
+
+                auto channel_it = state->channels.find(channel->name);
+                if (channel_it != state->channels.end() && channel_it->second == channel) {
+                    state->channels.erase(channel_it);
+                }
+            }
+        }
+
+        // Release the nickname
+        std::shared_ptr<std::string> nickname = client_ptr->nickname;
+        if (nickname) {
+            auto guard = std::lock_guard<std::mutex>(state->registered_clients_mutex);
+
+            auto it = state->registered_clients.find(*nickname);
+            if (it != state->registered_clients.end() && it->second == client_ptr) {
+                state->registered_clients.erase(it);
+            }
+        }
+    }
+
+    void communicator(const std::shared_ptr<Client> &client_ptr, State *state) {
+        // A client session is made of two coroutines running on the client's event loop, one reading commands and
+        // one flushing the outbound queue. Instead of a thread per client, each suspended session costs just the
+        // two coroutine frames.
+        client_ptr->io.coroutines = 2;
+
+        // Keep track of the client activity, dropping silent connections
+        client_ptr->io.last_activity = now_ms();
+        client_ptr->io.pinged_at = 0;
+        client_ptr->io.acked_at = 0;
+
+        if (state->config.idle_timeout.count() > 0 || state->config.ping_interval.count() > 0) {
+            // The timer is cancelled before the client is released, a raw pointer avoids a reference cycle
+            Client *client = client_ptr.get();
+            client_ptr->io.idle_timer.callback = [client, state]() { check_idle(client->shared_from_this(), state); };
+
+            check_idle(client_ptr, state);
         }
 
-        // Exit :)
+        communicator_incoming(client_ptr, state);
+        communicator_outgoing(client_ptr, state);
     }
 
     //////////////////////
     // Inbound Messages //
     //////////////////////
 
-    bool communicator_incoming(const std::shared_ptr<Client> &client_ptr, State *state, char buffer[]) {
-        // Try reading the next message from the client in a non-blocking way. If there is no message available, or
-        // a timeout is triggered, a EAGAIN or EWOULDBLOCK error will happen, resulting in a -2 return.
-        int result = network::read_message(client_ptr->connection.socket_fd, buffer);
+    // Shared memory ring offered by a same-host client (/shm along with the ring memfd & eventfd). It is set up on the
+    // loop reading the client, the command never reaches the handlers. Stray fds are closed.
+    static void handle_shm(const std::shared_ptr<Client> &client_ptr, const std::string &message, State *state) {
+        IoState &io = client_ptr->io;
+        std::vector<int> fds = std::move(io.passed_fds);
+        io.passed_fds.clear();
+
+        bool offered = state->config.shm && message == config::SHM_MESSAGE && fds.size() == 3 &&
+                       io.ring.header == nullptr;
+        if (!offered) {
+            for (int fd: fds) {
+                close(fd);
+            }
 
-        // If there is no available message or something wrong happened, try again after a small delay
-        if (result == -2) {
-            std::this_thread::sleep_for(config::POLLING_INTERVAL);
-            return false;
+            client_ptr->add_message(std::make_shared<std::string>(config::SHM_REFUSED));
+            return;
         }
 
-        // Check for a likely unrecoverable error, if present, end this connection
-        if (result == -1) {
+        // The client offered something that isn't a valid ring, it can't be trusted with the session anymore
+        if (!attach_ring(client_ptr.get(), fds[0], fds[1], fds[2])) {
+            error::warning("The client with ip " + client_ptr->ip_str + " offered an invalid shared memory ring!");
             client_ptr->alive = false;
-            return true;
+            return;
         }
 
-        // Check for a closed connection from the client
-        if (result == 0) {
-            error::warning("The client with ip " + client_ptr->ip_str + " has ended its connection!");
-            client_ptr->alive = false;
-            return true;
-        }
+        client_ptr->add_message(std::make_shared<std::string>(config::SHM_ACCEPTED));
+    }
+
+    Coroutine communicator_incoming(std::shared_ptr<Client> client_ptr, State *state) {
+        // Check for new messages from the client while the application and client are alive
+        while (!state->kill && client_ptr->alive) {
+            // Wait for the next message from the client. The loop may also wake us up without one (-2), e.g. to
+            // re-check the client state.
+            int result = co_await read_frame(client_ptr.get(), state->config.read_budget);
+
+            if (result == -2) {
+                continue;
+            }
+
+            // Check for a likely unrecoverable error, if present, end this connection
+            if (result == -1) {
+                client_ptr->alive = false;
+                break;
+            }
+
+            // Check for a closed connection from the client
+            if (result == 0) {
+                error::warning("The client with ip " + client_ptr->ip_str + " has ended its connection!");
+                client_ptr->alive = false;
+                break;
+            }
+
+            // Any frame counts as a sign of life (and as the answer to a pending ping)
+            client_ptr->io.last_activity = now_ms();
+            client_ptr->io.pinged_at = 0;
+
+            // We have successfully received a message, result holds the actual message length, so we can build the
+            // string from the loop buffer.
+            std::string message(client_ptr->io.loop.load()->buffer, result);
+
+            if (message == config::SHM_MESSAGE || !client_ptr->io.passed_fds.empty()) {
+                handle_shm(client_ptr, message, state);
+                continue;
+            }
+
+            // Pace the client to its rate limits. The socket isn't read while the reader waits, so the kernel buffers
+            // fill up and TCP pushes back on the client, nothing is discarded.
+            bool throttled = false;
+            while (!state->kill && client_ptr->alive && message != config::PONG_MESSAGE) {
+                bool command = message[0] == '/';
+                auto delay = bucket_take(command ? &client_ptr->command_bucket : &client_ptr->chat_bucket,
+                                         command ? state->rate_limits.command_rate : state->rate_limits.chat_rate,
+                                         command ? state->rate_limits.command_burst : state->rate_limits.chat_burst,
+                                         now_ms());
+
+                if (delay.count() == 0) {
+                    break;
+                }
+
+                if (!throttled) {
+                    throttled = true;
+                    client_ptr->throttled_lines++;
+                }
+
+                co_await throttle(client_ptr.get(), delay);
+            }
+
+            // The server is overloaded and the client is one of its heaviest senders, wait until it recovers
+            client_ptr->received_bytes += result;
+            while (client_ptr->paused && !state->kill && client_ptr->alive) {
+                co_await throttle(client_ptr.get(), config::OVERLOAD_INTERVAL);
+            }
 
-        // We have successfully received a message, result holds the actual message length, so we can build the
-        // string by null-terminating it.
-        buffer[result] = '\0';
-        std::string message = buffer;
+            // Do something with the message, not my problem... (either handle it here or send it to a handler thread)
+            while (!dispatch(message, client_ptr, state) && !state->kill && client_ptr->alive) {
+                // The handlers are behind, stop reading until they catch up
+                co_await wait_dispatch(client_ptr, state);
+            }
+        }
 
-        // Do something with the message, not my problem...
-        handle(message, client_ptr, state);
-        return false;
+        session_done(client_ptr, state);
     }
 
     ///////////////////////
     // Outbound Messages //
     ///////////////////////
 
-    bool communicator_outgoing(const std::shared_ptr<Client> &client_ptr, State *state) {
+    Coroutine communicator_outgoing(std::shared_ptr<Client> client_ptr, State *state) {
+        // Send pending messages on the queue, waiting for new ones (or room on the socket) in between
         while (!state->kill && client_ptr->alive) {
-            std::shared_ptr<std::string> message = client_ptr->pop_message();
+            // (the result is stored first, GCC 12 miscompiles a co_await inside the condition itself)
+            bool flushed = co_await flush(client_ptr.get(), state->config.write_budget);
 
-            if (!message) {
-                return false;
+            if (!flushed) {
+                client_ptr->alive = false;
+                break;
+            }
+        }
+
+        session_done(client_ptr, state);
+    }
+
+    // Queue the message to every member of the channel, in parallel chunks on the pool for big channels
+    static void fan_out(const Frame &message, const std::shared_ptr<Channel> &channel, Scheduler *pool,
+                        State *state) {
+        // Once the server is shedding load, members that are already behind miss the channel messages
+        bool shedding = state->overload.level >= SHEDDING;
+        auto deliver = [shedding, state](const std::shared_ptr<Client> &member, FanoutBatch &batch) {
+            // Skip dead clients
+            if (!member->alive) {
+                return;
             }
 
-            // Send direct response to client
-            std::pair<const std::shared_ptr<Client>, int> client_info = std::make_pair(client_ptr, 0);
+            if (shedding && member->outbound.backlogged()) {
+                state->overload.shed_messages++;
+                return;
+            }
 
-            // Try sending message until max tries reached
-            while (try_send_message(*message, client_info)) {
-                // Should be dead, skip
-                if (state->kill || !client_ptr->alive) {
-                    return true;
+            // Queued by the member's loop, along with the other members it owns
+            batch_message(batch, member);
+        };
+
+        {
+            auto guard = std::lock_guard<std::mutex>(channel->mutex);
+
+            if (pool == nullptr || channel->members.size() <= state->config.fanout_threshold) {
+                FanoutBatch batch{message, {}};
+                for (const auto &entry: channel->members) {
+                    // Add the message to the mailbox of the current client's loop
+                    deliver(entry, batch);
                 }
 
-                // Delay
-                std::this_thread::sleep_for(config::POLLING_INTERVAL);
+                // One post per loop, before the channel is released so every loop gets the channel messages in the
+                // same order
+                post_batch(batch);
+                return;
             }
         }
-        return false;
+
+        // Snapshot the members, the channel lock can't be held while waiting for the chunks (the waiting thread runs
+        // other tasks, which may need it)
+        std::vector<std::shared_ptr<Client> > members;
+        {
+            auto guard = std::lock_guard<std::mutex>(channel->mutex);
+            members.assign(channel->members.begin(), channel->members.end());
+        }
+
+        TaskGroup group;
+        for (size_t start = 0; start < members.size(); start += config::FANOUT_CHUNK_SIZE) {
+            size_t end = std::min(members.size(), start + config::FANOUT_CHUNK_SIZE);
+
+            spawn(pool, group, [&message, &members, &deliver, start, end]() {
+                FanoutBatch batch{message, {}};
+                for (size_t i = start; i < end; i++) {
+                    deliver(members[i], batch);
+                }
+
+                post_batch(batch);
+            });
+        }
+
+        // Wait for every chunk before returning, the next broadcast must not overtake this one
+        wait(pool, group);
     }
 
-    void broadcast_message_channel(const std::string &message, const std::shared_ptr<Channel> &channel) {
-        // Build a shared pointer to a copy of the message to avoid duplicating the message for each client which will
-        // receive it.
-        std::shared_ptr<std::string> message_ptr = std::make_shared<std::string>(message);
+    // Fan the sender's queued broadcasts out, one after the other. Only one of these tasks exists per sender at a
+    // time, like the handler tasks running its commands.
+    static void run_fanouts(const std::shared_ptr<Client> &sender, Scheduler *pool, State *state) {
+        while (true) {
+            std::pair<Frame, std::shared_ptr<Channel> > fanout;
 
-        for (const auto &entry: channel->members) {
-            // Skip dead clients
-            if (!entry->alive) {
-                continue;
+            {
+                auto guard = std::lock_guard<std::mutex>(sender->fanouts_mutex);
+
+                if (sender->fanouts.empty()) {
+                    sender->fanouts_scheduled = false;
+                    return;
+                }
+
+                fanout = std::move(sender->fanouts.front());
+                sender->fanouts.pop_front();
             }
 
-            // Add the message to the queue of the current client
-            entry->add_message(message_ptr);
+            fan_out(fanout.first, fanout.second, pool, state);
         }
     }
 
-    bool try_send_message(const std::string &message, std::pair<const std::shared_ptr<Client>, int> &client_info) {
-        // If the connection has recently died, shouldn't be retried
-        if (!client_info.first->alive) {
-            return false;
+    void broadcast_message_channel(const Frame &message, const std::shared_ptr<Channel> &channel,
+                                   const std::shared_ptr<Client> &sender, State *state) {
+        // Log delivery: the message is appended once, the members' writers only need a wake-up to read it
+        if (channel->log) {
+            auto guard = std::unique_lock<std::mutex>(channel->mutex);
+            log_append(channel->log.get(), message);
+
+            FanoutBatch batch;
+            for (const auto &member: channel->members) {
+                if (member->alive) {
+                    batch_wake_writer(batch, member);
+                }
+            }
+
+            guard.unlock();
+            post_batch(batch);
+            return;
         }
 
-        // Try sending the message itself
-        int result = network::send_message(client_info.first->connection.socket_fd,
-                                           const_cast<char *>(message.c_str()),
-                                           (int) std::min(message.size(), (size_t) config::MAX_MESSAGE_SIZE));
+        // Already on the pool (a handler thread), fan out right here, waiting on the chunks runs other tasks meanwhile
+        Scheduler *pool = fanout_pool(state);
+        if (pool == nullptr || current_scheduler() == pool) {
+            fan_out(message, channel, pool, state);
+            return;
+        }
 
-        // Failed to send message, likely due to timeout
-        if (result == -2) {
-            // Iterate tries counter
-            client_info.second++;
+        // On an I/O thread: big channels are handed over to the pool so the loop's other connections don't wait for
+        // them. Small ones are delivered right away, unless earlier broadcasts of the sender are still on the pool
+        // (they must arrive first). Once the sender has nothing left there, its earlier fan-outs are all posted to the
+        // loops' FIFO (see post_batch), where an inline delivery posted now lands behind them, even on this loop.
+        bool big;
+        {
+            auto guard = std::lock_guard<std::mutex>(channel->mutex);
+            big = channel->members.size() > state->config.fanout_threshold;
+        }
 
-            // If the maximum tries was reached, make the connection dead and don't retry it
-            if (client_info.second >= config::MAX_SEND_TRIES) {
-                client_info.first->alive = false;
-                return false;
-            }
+        bool queued = false;
+        bool schedule = false;
+        {
+            auto guard = std::lock_guard<std::mutex>(sender->fanouts_mutex);
 
-            // Still should retry sending
-            return true;
-        }
+            if (big || sender->fanouts_scheduled) {
+                sender->fanouts.emplace_back(message, channel);
+                queued = true;
 
-        // Likely unrecoverable error, abort already
-        if (result == -1) {
-            error::error("Failed to send a message");
-            client_info.first->alive = false;
+                if (!sender->fanouts_scheduled) {
+                    sender->fanouts_scheduled = true;
+                    schedule = true;
+                }
+            }
+        }
 
-            // No retry needed
-            return false;
+        if (!queued) {
+            fan_out(message, channel, nullptr, state);
+            return;
         }
 
-        // No retry needed
-        return false;
+        if (schedule) {
+            spawn(pool, [sender, pool, state]() { run_fanouts(sender, pool, state); });
+        }
     }
 
     //////////////////////
@@ -358,6 +728,7 @@ namespace worker::server {
                 // Register client
                 state->registered_clients[*nick] = client_ptr;
                 client_ptr->nickname = nick;
+                client_ptr->prefix = std::make_shared<const std::string>(*nick + ": ");
             }
         }
 
@@ -423,6 +794,13 @@ namespace worker::server {
 
             // Remove target from members list
             target->channel->members.erase(target);
+
+            // Stop reading the channel log (log delivery mode), the target gets nothing from the channel anymore
+            auto guard2 = std::lock_guard<std::mutex>(target->cursor_mutex);
+            if (target->log == target->channel->log) {
+                target->log = nullptr;
+                target->cursor = 0;
+            }
         }
 
         target->channel = nullptr;
@@ -615,9 +993,29 @@ namespace worker::server {
         }
 
         // Add the target to the invites list
+        uint64_t serial;
         {
             auto guard = std::lock_guard<std::mutex>(client_ptr->channel->mutex);
-            client_ptr->channel->invites.insert(nick);
+            serial = ++client_ptr->channel->invite_serial;
+            client_ptr->channel->invites[nick] = serial;
+        }
+
+        // Expire the invite later, unless it was renewed in the meantime
+        if (state->config.invite_timeout.count() > 0) {
+            std::weak_ptr<Channel> channel_ref = client_ptr->channel;
+
+            post_after(client_ptr->io.loop, state->config.invite_timeout, [channel_ref, nick, serial]() {
+                std::shared_ptr<Channel> channel = channel_ref.lock();
+                if (!channel) {
+                    return;
+                }
+
+                auto guard = std::lock_guard<std::mutex>(channel->mutex);
+                auto it = channel->invites.find(nick);
+                if (it != channel->invites.end() && it->second == serial) {
+                    channel->invites.erase(it);
+                }
+            });
         }
 
         client_ptr->add_message(std::make_shared<std::string>("The user has been invited"));
@@ -690,9 +1088,16 @@ namespace worker::server {
             } else {
                 channel = std::make_shared<Channel>();
                 channel->name = name;
+                channel->loop = client_ptr->io.loop.load();
                 channel->chop = client_ptr->nickname;
                 channel->members.insert(client_ptr);
-                channel->invites.insert(*client_ptr->nickname);
+                channel->invites[*client_ptr->nickname] = 0; // The creator invite never expires
+
+                if (state->config.delivery == config::Delivery::LOG) {
+                    channel->log = std::make_shared<ChannelLog>();
+                    log_init(channel->log.get(), state->config.channel_log_size);
+                }
+
                 state->channels[name] = channel;
             }
         }
@@ -715,6 +1120,12 @@ namespace worker::server {
 
             // Add self to members list
             channel->members.insert(client_ptr);
+
+            // Start reading the channel log from here on (messages are appended under the channel lock, so none is
+            // missed nor seen twice)
+            auto guard2 = std::lock_guard<std::mutex>(client_ptr->cursor_mutex);
+            client_ptr->log = channel->log;
+            client_ptr->cursor = channel->log ? log_head(channel->log.get()) : 0;
         }
 
         // Leave any old channel
@@ -735,9 +1146,26 @@ namespace worker::server {
         // Update active channel
         client_ptr->channel = channel;
         client_ptr->add_message(std::make_shared<std::string>("Joined the channel!"));
+
+        // Move in with the other members, so the channel broadcasts stay on their loop
+        if (state->config.placement == config::Placement::CHANNEL) {
+            migrate(client_ptr, channel->loop, state);
+        }
     }
 
-    void handle_text(const std::string &message, const std::shared_ptr<Client> &client_ptr) {
+    void handle_text(const std::string &message, const std::shared_ptr<Client> &client_ptr, State *state) {
+        // Only the server pings carry the delimiter, drop it from the text so no member can forge one (or break a real
+        // one apart on its way to the client)
+        if (message.find(config::PING_MESSAGE[0]) != std::string::npos) {
+            std::string stripped = message;
+            stripped.erase(std::remove(stripped.begin(), stripped.end(), config::PING_MESSAGE[0]), stripped.end());
+
+            if (!stripped.empty()) {
+                handle_text(stripped, client_ptr, state);
+            }
+            return;
+        }
+
         if (!client_ptr->nickname) {
             client_ptr->add_message(
                     std::make_shared<std::string>("Identify yourself using /nick to be able to send a message"));
@@ -757,21 +1185,22 @@ namespace worker::server {
             return;
         }
 
-        // Size of the nickname prefix
-        size_t prefix_len = client_ptr->nickname->size() + 2;
+        // The nickname prefix is sent as its own slice, the text is copied once and shared by every member
+        const std::shared_ptr<const std::string> &prefix = client_ptr->prefix;
 
-        if (message.size() + prefix_len <= config::MAX_MESSAGE_SIZE) {
+        if (message.size() + prefix->size() <= config::MAX_MESSAGE_SIZE) {
             // Broadcast message to every client
-            broadcast_message_channel((*client_ptr->nickname) + ": " + message, client_ptr->channel);
+            broadcast_message_channel({prefix, std::make_shared<const std::string>(message)}, client_ptr->channel,
+                                      client_ptr, state);
         } else {
             // Split the message into two
-            size_t cut_idx = config::MAX_MESSAGE_SIZE - prefix_len;
-            std::string left_str = (*client_ptr->nickname) + ": " + message.substr(0, cut_idx);
-            std::string right_str = (*client_ptr->nickname) + ": " + message.substr(cut_idx, message.size());
+            size_t cut_idx = config::MAX_MESSAGE_SIZE - prefix->size();
+            auto left = std::make_shared<const std::string>(message, 0, cut_idx);
+            auto right = std::make_shared<const std::string>(message, cut_idx);
 
             // Send both messages
-            broadcast_message_channel(left_str, client_ptr->channel);
-            broadcast_message_channel(right_str, client_ptr->channel);
+            broadcast_message_channel({prefix, left}, client_ptr->channel, client_ptr, state);
+            broadcast_message_channel({prefix, right}, client_ptr->channel, client_ptr, state);
         }
     }
 
@@ -780,7 +1209,7 @@ namespace worker::server {
     void handle(const std::string &message, const std::shared_ptr<Client> &client_ptr, State *state) {
         // Check if it's a normal message, if it is, concatenate the client nickname and broadcast it
         if (message[0] != '/') {
-            handle_text(message, client_ptr);
+            handle_text(message, client_ptr, state);
             return;
         }
 
@@ -789,6 +1218,9 @@ namespace worker::server {
         // Handle quit command
         if (strcasecmp("/quit", message_cstr) == 0) {
             client_ptr->alive = false;
+
+            // Wake the session up, so the connection is closed right away
+            wake_reader(client_ptr);
             return;
         }
 
@@ -804,6 +1236,11 @@ namespace worker::server {
             return;
         }
 
+        // Handle the reply to a server ping (the activity was already accounted for by the session)
+        if (strcasecmp(config::PONG_MESSAGE.c_str(), message_cstr) == 0) {
+            return;
+        }
+
         if (strncasecmp("/nick", message_cstr, 5) == 0 && (message.size() <= 5 || message[5] == ' ')) {
             handle_nick(message, client_ptr, state);
             return;
@@ -852,25 +1289,55 @@ namespace worker::server {
     // Client message queue management //
     /////////////////////////////////////
 
-    void Client::add_message(const std::shared_ptr<std::string> &message) {
-        // Prevent concurrency while modifying the client's message queue
-        auto guard = std::lock_guard<std::mutex>(this->message_queue_mutex);
-        // Add the new message to the end of the message queue
-        this->message_queue.push(message);
+    void Client::add_message(const Frame &message, MessageKind kind) {
+        // Let the session flush it
+        if (this->queue_message(message, kind)) {
+            wake_writer(this->shared_from_this());
+        }
     }
 
-    std::shared_ptr<std::string> Client::pop_message() {
-        // Prevent concurrency while modifying the client's message queue
-        auto guard = std::lock_guard<std::mutex>(this->message_queue_mutex);
+    bool Client::queue_message(const Frame &message, MessageKind kind) {
+        // Dead clients never flush their queue, don't let it grow
+        if (!this->alive) {
+            return false;
+        }
+
+        PushResult result = this->outbound.push(message, kind);
+        count_enqueue(this);
+
+        // The client can't keep up and the policy is to get rid of it
+        if (result == OVERFLOW) {
+            error::warning("The client with ip " + this->ip_str + " is too slow, disconnecting");
+            this->alive = false;
+            wake_reader(this->shared_from_this());
+            return false;
+        }
+
+        return result == QUEUED;
+    }
+
+    Frame Client::pop_message() {
+        Frame message = this->outbound.pop();
+        if (message) {
+            return message;
+        }
+
+        // Then the channel messages, straight from the channel log (log delivery mode)
+        auto guard = std::lock_guard<std::mutex>(this->cursor_mutex);
+        if (!this->log) {
+            return {};
+        }
+
+        uint64_t skipped = 0;
+        message = log_read(this->log.get(), this->cursor, skipped);
 
-        // If the queue is empty, return a null pointer
-        if (this->message_queue.empty()) {
-            return nullptr;
+        // The log moved on without us, tell the client it missed part of the conversation
+        if (skipped > 0) {
+            this->lagged += skipped;
+            return std::make_shared<std::string>("You lagged behind the channel, " + std::to_string(skipped) +
+                                                 " messages were skipped");
         }
 
-        // Get the front element and remove it from the queue
-        auto data = this->message_queue.front();
-        this->message_queue.pop();
-        return data;
+        return message;
     }
 }
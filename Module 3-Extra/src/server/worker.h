@@ -1,23 +1,38 @@
 #pragma once
 
 #include<atomic>
+#include<deque>
+#include<map>
 #include<memory>
 #include<mutex>
 #include<queue>
 #include<string>
 #include<unordered_map>
 #include<set>
+#include<vector>
 
 #include<unistd.h>
 
 #include "../common/network.h"
 
+#include "channellog.h"
+#include "loop.h"
+#include "outbound.h"
+#include "overload.h"
+#include "pipeline.h"
+#include "ratelimit.h"
+#include "rebalance.h"
+#include "tuning.h"
+
 namespace worker::server {
     struct Client;
     struct Channel;
     struct State;
 
-    struct Client {
+    struct Client : std::enable_shared_from_this<Client> {
+        // Unique client identifier (assigned on accept)
+        uint64_t id;
+
         // Current client connection (socket and IP info)
         network::Connection connection;
         // Client IP string representation (for convenience)
@@ -25,18 +40,59 @@ namespace worker::server {
         // Should the client connection still be alive
         std::atomic<bool> alive;
 
+        // Session state on its event loop
+        IoState io;
+
         // Clients' current nickname
         std::shared_ptr<std::string> nickname;
-
-        // Message queue (messages that are pending to be sent to the given user)
-        std::mutex message_queue_mutex;
-        std::queue<std::shared_ptr<std::string> > message_queue;
+        // Pre-encoded prefix of its channel messages ("nick: "), shared by all of them until the nickname changes
+        std::shared_ptr<const std::string> prefix;
+
+        // Message queue (messages that are pending to be sent to the given user), bounded
+        OutboundQueue outbound;
+
+        // Inbound rate limiting, chat lines and commands are paced separately (reader only)
+        TokenBucket chat_bucket;
+        TokenBucket command_bucket;
+        // Lines the client had to wait for
+        uint64_t throttled_lines;
+
+        // Bytes received from the client, and the last value seen by the overload controller
+        std::atomic<uint64_t> received_bytes;
+        uint64_t received_sampled;
+        // The server is overloaded and this is one of its heaviest senders, don't read from it
+        std::atomic<bool> paused;
+
+        // Loop work of the connection seen by the last rebalance (rebalancer only)
+        uint64_t work_sampled;
+
+        // Commands waiting for a handler thread (pipeline mode), only one handler runs them at a time
+        std::mutex commands_mutex;
+        std::deque<std::string> commands;
+        bool commands_scheduled;
+        // The reader is in the pipeline waiting list (guarded by the pipeline mutex), the loop may resume it more than
+        // once while it waits, it is only listed once
+        bool waiting_dispatch;
+
+        // Broadcasts of the client still being fanned out by the fan-out threads, in order, only one of them runs at a
+        // time (anything the client broadcasts meanwhile waits behind them)
+        std::mutex fanouts_mutex;
+        std::deque<std::pair<Frame, std::shared_ptr<Channel> > > fanouts;
+        bool fanouts_scheduled;
 
         // Clients' currently joined channel
         std::shared_ptr<Channel> channel;
 
-        void add_message(const std::shared_ptr<std::string> &message);
-        std::shared_ptr<std::string> pop_message();
+        // Read position in the joined channel's log (log delivery mode), and the messages skipped after lagging
+        std::mutex cursor_mutex;
+        std::shared_ptr<ChannelLog> log;
+        uint64_t cursor;
+        uint64_t lagged;
+
+        void add_message(const Frame &message, MessageKind kind = CONTROL);
+        // Queue a message without waking the writer up, returns true if the writer needs a wake-up for it
+        bool queue_message(const Frame &message, MessageKind kind);
+        Frame pop_message();
     };
 
     enum ChannelFlags {
@@ -50,6 +106,9 @@ namespace worker::server {
 
         // Channel identifier
         std::string name;
+        // Event loop the members are gathered on (placement by channel), the creator's one until the rebalancer moves
+        // the channel
+        std::atomic<EventLoop *> loop;
 
         // Channel operator (user responsible for administrating the channel)
         std::shared_ptr<std::string> chop;
@@ -62,17 +121,50 @@ namespace worker::server {
         std::set<std::string> muted;
         // Users banned in the channel
         std::set<std::string> banned;
-        // Invited users to the channel (for invite only mode)
-        std::set<std::string> invites;
+        // Invited users to the channel (for invite only mode), with the serial of their latest invite (0 for
+        // permanent ones)
+        std::map<std::string, uint64_t> invites;
+        uint64_t invite_serial;
+
+        // Latest messages, read by the members (log delivery mode only)
+        std::shared_ptr<ChannelLog> log;
     };
 
     struct State {
         // Main listening socket file descriptor
         int socket_fd;
 
+        // Unix domain socket listeners, for clients on the same host
+        std::vector<int> local_fds;
+
+        // What the acceptor waits on while idle: the main listener alone, or an epoll set of every listener
+        int accept_fd;
+
+        // Server configuration (from the command line)
+        config::ServerConfig config;
+
+        // Inbound rate limits in effect, reloaded from the rate limits file on request (SIGHUP)
+        RateLimits rate_limits;
+        std::atomic<bool> reload;
+
         // Server kill state flag
         std::atomic<bool> kill;
 
+        // Next client identifier to be assigned
+        std::atomic<uint64_t> next_client_id;
+
+        // Event loops multiplexing the client connections
+        std::vector<std::unique_ptr<EventLoop> > loops;
+
+        // Handler threads & queues (pipeline mode)
+        Pipeline pipeline;
+
+        // Overload controller state & metrics
+        Overload overload;
+
+        // Loop rebalancer state & metrics
+        Rebalancer rebalancer;
+
         // Clients which are "logged-in" (have a nickname configured)
         std::mutex registered_clients_mutex;
         std::unordered_map<std::string, std::shared_ptr<Client> > registered_clients;
@@ -88,15 +180,22 @@ namespace worker::server {
 
     void manager(State *state);
 
-    void communicator(const std::shared_ptr<Client>& client_ptr, State *state);
+    void reaper(State *state);
 
-    bool communicator_outgoing(const std::shared_ptr<Client>& client_ptr, State *state);
+    // Release everything a closed connection still holds (queued messages, channel membership, nickname)
+    void teardown(const std::shared_ptr<Client> &client_ptr, State *state);
+
+    void communicator(const std::shared_ptr<Client>& client_ptr, State *state);
 
-    bool communicator_incoming(const std::shared_ptr<Client>& client_ptr, State *state, char buffer[]);
+    Coroutine communicator_outgoing(std::shared_ptr<Client> client_ptr, State *state);
 
-    bool try_send_message(const std::string &message, std::pair<const std::shared_ptr<Client>, int> &client_info);
+    Coroutine communicator_incoming(std::shared_ptr<Client> client_ptr, State *state);
 
     void handle(const std::string &message, const std::shared_ptr<Client>& client_ptr, State *state);
 
-    void broadcast_message_channel(const std::string &message, const std::shared_ptr<Channel>& channel);
+    // Send a message to every member of the channel. The sender's broadcasts reach each member in order, big channels
+    // are fanned out in parallel (off the sender's thread if it isn't a fan-out one already). The frame's buffers are
+    // shared by every member, none of them gets a copy.
+    void broadcast_message_channel(const Frame &message, const std::shared_ptr<Channel> &channel,
+                                   const std::shared_ptr<Client> &sender, State *state);
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+# Every member of a channel gets its messages in the same order, with the senders and members spread over several
+# event loops.
+#
+# Usage: channel_order.py <server binary>
+
+import re
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+MEMBERS = 20
+MESSAGES = 1500
+
+
+def free_port():
+    with socket.socket() as probe:
+        probe.bind(("127.0.0.1", 0))
+        return probe.getsockname()[1]
+
+
+def connect(port, nick):
+    for _ in range(100):
+        try:
+            connection = socket.create_connection(("127.0.0.1", port))
+            break
+        except ConnectionRefusedError:
+            time.sleep(0.05)
+    else:
+        raise RuntimeError("the server didn't come up")
+
+    connection.send(("/nick " + nick).encode())
+    time.sleep(0.02)
+    connection.send(b"/join #order")
+    time.sleep(0.02)
+    return connection
+
+
+def main():
+    server = sys.argv[1]
+    port = free_port()
+    process = subprocess.Popen([server, str(port), "127.0.0.1", "--io-threads=2"], stdout=subprocess.DEVNULL,
+                               stderr=subprocess.DEVNULL)
+    try:
+        # Connections go to the loops in turn, so both senders and the members are split between the two
+        senders = [connect(port, "alice"), connect(port, "bob")]
+        members = [connect(port, "member" + str(i)) for i in range(MEMBERS)]
+        time.sleep(0.3)
+
+        received = [b""] * MEMBERS
+        done = threading.Event()
+
+        def read(index):
+            members[index].settimeout(0.2)
+            while not done.is_set():
+                try:
+                    data = members[index].recv(65536)
+                    if not data:
+                        break
+                    received[index] += data
+                except socket.timeout:
+                    pass
+
+        def flood(connection, tag):
+            for i in range(MESSAGES):
+                connection.send(("<" + tag + str(i) + ">").encode())
+                time.sleep(0.0002)
+
+        readers = [threading.Thread(target=read, args=(i,)) for i in range(MEMBERS)]
+        floods = [threading.Thread(target=flood, args=(senders[0], "A")),
+                  threading.Thread(target=flood, args=(senders[1], "B"))]
+        for thread in readers + floods:
+            thread.start()
+        for thread in floods:
+            thread.join()
+
+        time.sleep(2)
+        done.set()
+        for thread in readers:
+            thread.join()
+    finally:
+        process.terminate()
+        process.wait()
+
+    orders = [re.findall(rb"<([AB]\d+)>", data) for data in received]
+    complete = sum(len(order) == 2 * MESSAGES for order in orders)
+    same = sum(order == orders[0] for order in orders)
+
+    print("complete " + str(complete) + "/" + str(MEMBERS) + ", same order " + str(same) + "/" + str(MEMBERS))
+    return 0 if complete == MEMBERS and same == MEMBERS else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
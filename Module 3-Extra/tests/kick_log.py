@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+# A member kicked from a channel receives nothing from it afterwards, in both delivery modes.
+#
+# Usage: kick_log.py <server binary>
+
+import socket
+import subprocess
+import sys
+import time
+
+
+def free_port():
+    with socket.socket() as probe:
+        probe.bind(("127.0.0.1", 0))
+        return probe.getsockname()[1]
+
+
+def connect(port):
+    for _ in range(100):
+        try:
+            connection = socket.create_connection(("127.0.0.1", port))
+            connection.settimeout(0.3)
+            return connection
+        except ConnectionRefusedError:
+            time.sleep(0.05)
+
+    raise RuntimeError("the server didn't come up")
+
+
+def send(connection, message):
+    connection.send(message.encode())
+    time.sleep(0.1)
+
+
+def receive(connection):
+    received = b""
+    try:
+        while True:
+            data = connection.recv(65536)
+            if not data:
+                break
+            received += data
+    except socket.timeout:
+        pass
+
+    return received.decode(errors="replace")
+
+
+def check(server, delivery):
+    port = free_port()
+    process = subprocess.Popen([server, str(port), "127.0.0.1", "--delivery=" + delivery], stdout=subprocess.DEVNULL,
+                               stderr=subprocess.DEVNULL)
+    try:
+        alice = connect(port)
+        bob = connect(port)
+
+        send(alice, "/nick alice")
+        send(bob, "/nick bob")
+        send(alice, "/join #kick")
+        send(bob, "/join #kick")
+        send(alice, "before-kick")
+
+        if "before-kick" not in receive(bob):
+            print(delivery + ": the member didn't receive the channel messages before the kick")
+            return False
+
+        send(alice, "/kick bob")
+        if "You were kicked from the channel" not in receive(bob):
+            print(delivery + ": the member wasn't told about the kick")
+            return False
+
+        # Whatever wakes the member's writer up (here the answer to a ping) must not bring the channel along
+        send(alice, "after-kick")
+        send(bob, "/ping")
+        received = receive(bob)
+        if "after-kick" in received:
+            print(delivery + ": the kicked member still received the channel messages: " + repr(received))
+            return False
+
+        return True
+    finally:
+        process.terminate()
+        process.wait()
+
+
+def main():
+    server = sys.argv[1]
+    passed = all([check(server, "queue"), check(server, "log")])
+
+    print("passed" if passed else "failed")
+    return 0 if passed else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())